@@ -0,0 +1,105 @@
+/* baseline.c -- --baseline, and pinning an output to compare against
+ *
+ * Where --differences compares each frame with the one before, so that
+ * slow drift never shows, a baseline stays put: every line of output
+ * that is not in it is highlighted, and the header counts the lines
+ * added and gone.  It comes from a file, is pinned from the current
+ * output with the B key or the control FIFO, or, for a --baseline file
+ * that does not exist yet, is the first output, which is also saved
+ * there for the next time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "baseline.h"
+
+static const char *save_path;	/* write the first output here */
+static int pin_pending;		/* pin once the run in progress is done */
+
+/* the whole file, or NULL with errno set */
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *fp = fopen(path, "r");
+	char *buf = NULL, *p;
+	size_t size = 0, n;
+
+	if (fp == NULL)
+		return NULL;
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 4096;
+			if ((p = realloc(buf, size)) == NULL) {
+				free(buf);
+				fclose(fp);
+				return NULL;
+			}
+			buf = p;
+		}
+		n = fread(buf + *len, 1, size - *len, fp);
+		*len += n;
+	} while (n > 0);
+	if (ferror(fp)) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	return buf;
+}
+
+int baseline_load(struct watch_ctx *w, const char *path)
+{
+	size_t len;
+	char *text;
+	int r;
+
+	if (path == NULL)
+		return watch_set_baseline(w, NULL, 0);
+	if ((text = read_file(path, &len)) == NULL)
+		return -1;
+	r = watch_set_baseline(w, text, len);
+	free(text);
+	return r;
+}
+
+int baseline_open(struct watch_ctx *w, const char *path)
+{
+	if (baseline_load(w, path) == 0)
+		return 0;
+	if (errno != ENOENT) {
+		perror(path);
+		return -1;
+	}
+	save_path = path;
+	return 0;
+}
+
+void baseline_pin(struct watch_ctx *w)
+{
+	/* mid-run the capture is only part of the output */
+	if (w->state != WATCH_IDLE)
+		pin_pending = 1;
+	else if (w->capture)	/* there has been a run */
+		watch_set_baseline(w, w->capture, w->capture_len);
+}
+
+void baseline_frame(struct watch_ctx *w)
+{
+	FILE *fp;
+
+	if (pin_pending) {
+		pin_pending = 0;
+		baseline_pin(w);
+	}
+	if (save_path == NULL)
+		return;
+	baseline_pin(w);
+	/* nowhere to complain while curses has the terminal; the next
+	 * watch will try again */
+	if ((fp = fopen(save_path, "w")) != NULL) {
+		fwrite(w->capture, 1, w->capture_len, fp);
+		fclose(fp);
+	}
+	save_path = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef WATCH_BASELINE_H
+#define WATCH_BASELINE_H
+
+#include "libwatch.h"
+
+/* compare against the --baseline file, or against the first output if
+ * there is no such file yet, writing it there; returns 0, or -1 after a
+ * message */
+extern int baseline_open(struct watch_ctx *w, const char *path);
+
+/* compare against what is in the file, or stop comparing for NULL;
+ * -1 if it cannot be read */
+extern int baseline_load(struct watch_ctx *w, const char *path);
+
+/* compare against the output of the last run from now on; during a run,
+ * against that run's once it is done */
+extern void baseline_pin(struct watch_ctx *w);
+
+/* a run finished */
+extern void baseline_frame(struct watch_ctx *w);
+
+#endif
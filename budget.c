@@ -0,0 +1,216 @@
+/* budget.c -- a token bucket every watch on the host draws from, for
+ * --budget
+ *
+ * The bucket of a class lives in POSIX shared memory, /watch-budget.CLASS,
+ * and is kept as the generic cell rate algorithm has it: the one time
+ * (on the monotonic clock, which all processes share) at which the
+ * bucket will be empty again.  Taking a token reserves the next slot
+ * whether or not one is free now and says how long to wait for it, so
+ * instances are served in the order they asked, each holding at most one
+ * reservation, and one that dies while waiting holds nothing up.  Updates
+ * are made under flock(), which the kernel releases for a process that
+ * is killed.  The rate and burst are the first watch's to set, and stay
+ * as it set them while it runs.  As anyone may write to the segment,
+ * everything in it is checked before use: a rate or burst out of range
+ * is replaced by the taker's own, and a bucket booked further ahead than
+ * BUDGET_WAITERS_MAX waiters could have is taken to be empty now.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "budget.h"
+
+#define BUDGET_MAGIC 0x77626732u	/* "wbg2" */
+/* more watches than this waiting on one bucket at once is not believed:
+ * it bounds how far ahead the bucket can be booked */
+#define BUDGET_WAITERS_MAX 4096
+
+struct budget_shared {
+	unsigned magic;		/* BUDGET_MAGIC once set up */
+	double rate;		/* runs per second */
+	int burst;		/* runs at once after a quiet spell */
+	pid_t setter;		/* the watch that set them */
+	watch_usec_t empty_at;	/* when the bucket is empty again */
+	/* since the bucket was made */
+	unsigned long long grants, waits;
+	watch_usec_t waited, max_wait;
+};
+
+struct watch_budget {
+	int fd;
+	struct budget_shared *s;
+	double rate;		/* as this watch asked for */
+	int burst;
+};
+
+static watch_usec_t monotonic_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (watch_usec_t) ts.tv_sec * USECS_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static int sane(double rate, int burst)
+{
+	return rate >= WATCH_BUDGET_RATE_MIN && rate <= WATCH_BUDGET_RATE_MAX
+	    && burst >= 1 && burst <= WATCH_BUDGET_BURST_MAX;
+}
+
+/* whether the watch that set the rate is still about (EPERM: as
+ * another user) */
+static int running(pid_t pid)
+{
+	return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static int shm_path(char *buf, size_t size, const char *class)
+{
+	if (snprintf(buf, size, "/watch-budget.%s", class) >= (int) size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+static struct watch_budget *attach(const char *class, int create,
+    const char **func)
+{
+	struct watch_budget *b;
+	char path[256];
+
+	if (shm_path(path, sizeof path, class) < 0) {
+		*func = "shm_open";
+		return NULL;
+	}
+	if ((b = calloc(1, sizeof *b)) == NULL) {
+		*func = "malloc";
+		return NULL;
+	}
+	/* open for everyone: the point is to share it between users */
+	if ((b->fd = shm_open(path, O_RDWR | (create ? O_CREAT : 0), 0666)) < 0) {
+		*func = "shm_open";
+		free(b);
+		return NULL;
+	}
+	if (create) {
+		fchmod(b->fd, 0666);	/* whatever the umask */
+		if (ftruncate(b->fd, sizeof *b->s) < 0) {
+			*func = "ftruncate";
+			goto fail;
+		}
+	}
+	b->s = mmap(NULL, sizeof *b->s, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+	if (b->s == MAP_FAILED) {
+		*func = "mmap";
+		goto fail;
+	}
+	return b;
+
+fail:
+	close(b->fd);
+	free(b);
+	return NULL;
+}
+
+struct watch_budget *budget_open(const char *class, double rate, int burst,
+    const char **func)
+{
+	struct watch_budget *b = attach(class, 1, func);
+
+	if (b == NULL)
+		return NULL;
+	b->rate = rate;
+	b->burst = burst;
+	flock(b->fd, LOCK_EX);
+	if (b->s->magic != BUDGET_MAGIC) {
+		memset(b->s, 0, sizeof *b->s);
+		b->s->magic = BUDGET_MAGIC;
+	}
+	if (!sane(b->s->rate, b->s->burst) || b->s->setter == getpid()
+	    || !running(b->s->setter)) {
+		b->s->rate = rate;
+		b->s->burst = burst;
+		b->s->setter = getpid();
+	}
+	flock(b->fd, LOCK_UN);
+	return b;
+}
+
+void budget_close(struct watch_budget *b)
+{
+	if (b == NULL)
+		return;
+	munmap(b->s, sizeof *b->s);
+	close(b->fd);
+	free(b);
+}
+
+watch_usec_t budget_take(struct watch_budget *b)
+{
+	struct budget_shared *s = b->s;
+	watch_usec_t now, period, tolerance, horizon, at, wait;
+
+	flock(b->fd, LOCK_EX);
+	if (!sane(s->rate, s->burst)) {	/* written over: ours instead */
+		s->rate = b->rate;
+		s->burst = b->burst;
+		s->setter = getpid();
+	}
+	now = monotonic_usec();
+	period = USECS_PER_SEC / s->rate;
+	tolerance = (watch_usec_t) (s->burst - 1) * period;
+	/* within range of the checks above, so none of this overflows */
+	horizon = now + tolerance + BUDGET_WAITERS_MAX * period;
+	at = s->empty_at > now && s->empty_at <= horizon ? s->empty_at : now;
+	wait = at > now + tolerance ? at - tolerance - now : 0;
+	s->empty_at = at + period;
+	s->grants++;
+	if (wait) {
+		s->waits++;
+		s->waited += wait;
+		if (wait > s->max_wait)
+			s->max_wait = wait;
+	}
+	flock(b->fd, LOCK_UN);
+	return wait;
+}
+
+int budget_stats(const char *class, FILE *fp, const char **func)
+{
+	struct watch_budget *b = attach(class, 0, func);
+	struct budget_shared s;
+	watch_usec_t now;
+
+	if (b == NULL)
+		return -1;
+	flock(b->fd, LOCK_SH);
+	s = *b->s;
+	flock(b->fd, LOCK_UN);
+	now = monotonic_usec();
+	budget_close(b);
+	if (s.magic != BUDGET_MAGIC) {
+		errno = ENOENT;
+		*func = "shm_open";
+		return -1;
+	}
+	fprintf(fp, "class %s: %g runs/s, burst %d, set by pid %ld\n", class,
+	    s.rate, s.burst, (long) s.setter);
+	fprintf(fp, "runs %llu, waited %llu times, %.3fs in all, %.3fs at most\n",
+	    s.grants, s.waits, (double) s.waited / USECS_PER_SEC,
+	    (double) s.max_wait / USECS_PER_SEC);
+	fprintf(fp, "booked ahead %.3fs\n",
+	    s.empty_at > now ? (double) (s.empty_at - now) / USECS_PER_SEC : 0.0);
+	return 0;
+}
@@ -0,0 +1,23 @@
+/* budget.h -- the host-wide bucket behind --budget; private to the library */
+
+#ifndef WATCH_BUDGET_H
+#define WATCH_BUDGET_H
+
+#include <stdio.h>
+#include "libwatch.h"
+
+/* open the bucket of class, creating it if need be, and set it to rate
+ * runs a second with bursts of up to burst unless another watch that is
+ * still running did; NULL with *func and errno set on failure */
+extern struct watch_budget *budget_open(const char *class, double rate,
+    int burst, const char **func);
+extern void budget_close(struct watch_budget *b);
+
+/* take a token: the usec to wait before the run it is for */
+extern watch_usec_t budget_take(struct watch_budget *b);
+
+/* write what the bucket of class has seen to fp; -1 with *func and
+ * errno set when there is no such bucket */
+extern int budget_stats(const char *class, FILE *fp, const char **func);
+
+#endif
@@ -0,0 +1,174 @@
+/* control.c -- the --control FIFO
+ *
+ * Lines written to the FIFO change a running watch without restarting it,
+ * so its history and cumulative differences survive:
+ *
+ *	interval SECONDS	run every SECONDS from now on
+ *	pause			stop running the command
+ *	resume			start again
+ *	run			run the command now (and resume)
+ *	command COMMAND...	run COMMAND through sh from now on
+ *	differences on|off|cumulative
+ *	dump FILE		write the current screen to FILE as text
+ *	history FILE [RUNS]	with --history, write the output of the run
+ *				RUNS (default 1) before the last to FILE
+ *	baseline [FILE|off]	highlight what differs from FILE, from the
+ *				current output, or stop
+ *
+ * Malformed lines are ignored, as there is nowhere to report them while
+ * curses owns the terminal.  The FIFO is read from watch's own event loop
+ * between frames, so commands never race with drawing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "control.h"
+#include "history.h"
+#include "baseline.h"
+
+#define CONTROL_LINE_MAX 4096
+
+static char line[CONTROL_LINE_MAX];
+static size_t line_len;
+static int discarding;	/* skipping the rest of an overlong line */
+
+/* returns -1 for a line that was not understood */
+static int control_command(struct watch_ctx *w, char *cmd)
+{
+	char *arg;
+
+	while (isspace((unsigned char) *cmd))
+		cmd++;
+	arg = cmd + strcspn(cmd, " \t");
+	if (*arg)
+		*arg++ = '\0';
+	while (isspace((unsigned char) *arg))
+		arg++;
+
+	if (!*cmd || *cmd == '#')
+		return 0;
+	if (!strcmp(cmd, "interval")) {
+		char *end;
+		double interval = strtod(arg, &end);
+		if (!*arg || *end)
+			return -1;
+		if(interval < 0.1)
+			interval = 0.1;
+		if(interval > ~0u/1000000)
+			interval = ~0u/1000000;
+		watch_set_interval(w, interval);
+	} else if (!strcmp(cmd, "pause")) {
+		watch_pause(w, 1);
+	} else if (!strcmp(cmd, "resume")) {
+		watch_pause(w, 0);
+	} else if (!strcmp(cmd, "run")) {
+		watch_run_now(w);
+	} else if (!strcmp(cmd, "command")) {
+		/* the context keeps using the old string until told otherwise,
+		 * so the old one is only let go of afterwards */
+		static char *current;
+		char *command = strdup(arg);
+		if (!*arg || command == NULL || watch_set_command(w, command) < 0) {
+			free(command);
+			return -1;
+		}
+		free(current);
+		current = command;
+	} else if (!strcmp(cmd, "differences")) {
+		if (!strcmp(arg, "on"))
+			watch_set_differences(w, 1, 0);
+		else if (!strcmp(arg, "off"))
+			watch_set_differences(w, 0, 0);
+		else if (!strcmp(arg, "cumulative"))
+			watch_set_differences(w, 1, 1);
+		else
+			return -1;
+	} else if (!strcmp(cmd, "dump")) {
+		FILE *fp = *arg ? fopen(arg, "w") : NULL;
+		if (fp == NULL)
+			return -1;
+		watch_dump(w, fp);
+		fclose(fp);
+	} else if (!strcmp(cmd, "history")) {
+		char *file = arg, *end;
+		unsigned long ago = 1;
+		FILE *fp;
+
+		arg += strcspn(arg, " \t");
+		if (*arg) {
+			*arg++ = '\0';
+			ago = strtoul(arg, &end, 10);
+			if (!*arg || *end)
+				return -1;
+		}
+		if (!*file || (fp = fopen(file, "w")) == NULL)
+			return -1;
+		if (history_write(fp, ago) < 0) {
+			fclose(fp);
+			unlink(file);
+			return -1;
+		}
+		fclose(fp);
+	} else if (!strcmp(cmd, "baseline")) {
+		if (!*arg)
+			baseline_pin(w);
+		else if (baseline_load(w, strcmp(arg, "off") ? arg : NULL) < 0)
+			return -1;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+int control_open(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if (mkfifo(path, 0600) < 0 && errno != EEXIST) {
+		perror(path);
+		return -1;
+	}
+	if (stat(path, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+		fprintf(stderr, "%s: not a FIFO\n", path);
+		return -1;
+	}
+	/* O_RDWR keeps a writer around, so the FIFO never reads as EOF
+	 * between clients */
+	if ((fd = open(path, O_RDWR | O_NONBLOCK)) < 0) {
+		perror(path);
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+void control_read(struct watch_ctx *w, int fd)
+{
+	char buf[1024];
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof buf)) > 0) {
+		ssize_t i;
+		for (i = 0; i < n; i++) {
+			if (buf[i] != '\n') {
+				if (line_len < sizeof line - 1)
+					line[line_len++] = buf[i];
+				else
+					discarding = 1;
+				continue;
+			}
+			line[line_len] = '\0';
+			if (!discarding)
+				control_command(w, line);
+			line_len = 0;
+			discarding = 0;
+		}
+	}
+}
@@ -0,0 +1,13 @@
+#ifndef WATCH_CONTROL_H
+#define WATCH_CONTROL_H
+
+#include "libwatch.h"
+
+/* open (creating if need be) the --control FIFO; returns its fd or -1
+ * after a message */
+extern int control_open(const char *path);
+
+/* read and carry out whatever commands have arrived on fd */
+extern void control_read(struct watch_ctx *w, int fd);
+
+#endif
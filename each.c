@@ -0,0 +1,267 @@
+/* each.c -- run the command once per target, for --each
+ *
+ * This runs in the child watch_spawn() forks, in place of the command.
+ * It starts one instance per target, with every {} in the command
+ * replaced by the target (or the target added at the end when there is
+ * no {}), at most jobs at a time, and reads all their outputs at once,
+ * so a run takes about as long as its slowest target rather than all of
+ * them together.  When the last one is done the outputs are written in
+ * the order of the targets, each below a line with the target, its exit
+ * status and how long it took.
+ *
+ * Every section is padded to the most lines it has needed so far,
+ * counted in memory shared with watch, so one target's output does not
+ * move when another's grows or shrinks, and --differences compares each
+ * target with itself.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "each.h"
+
+#define EACH_JOBS 16	/* targets at once unless told otherwise */
+
+struct target {
+	pid_t pid;
+	int fd;			/* -1 once done */
+	int status;
+	char *out;
+	size_t len, size;
+	watch_usec_t start, end;
+};
+
+/* s with every {} replaced by target; NULL when there is none */
+static char *substitute(const char *s, const char *target)
+{
+	size_t tlen = strlen(target), len = strlen(s);
+	const char *p;
+	char *r, *q;
+	int n = 0;
+
+	for (p = s; (p = strstr(p, "{}")) != NULL; p += 2)
+		n++;
+	if (!n)
+		return NULL;
+	if ((r = malloc(len + n * tlen + 1)) == NULL)
+		return NULL;
+	for (q = r; (p = strstr(s, "{}")) != NULL; s = p + 2) {
+		memcpy(q, s, p - s);
+		q += p - s;
+		memcpy(q, target, tlen);
+		q += tlen;
+	}
+	strcpy(q, s);
+	return r;
+}
+
+/* the command line for one target, as a shell command or an argv */
+static char *shell_command(const char *command, const char *target)
+{
+	char *r = substitute(command, target);
+
+	if (r == NULL && !strstr(command, "{}")
+	    && (r = malloc(strlen(command) + strlen(target) + 2)) != NULL)
+		sprintf(r, "%s %s", command, target);
+	return r;
+}
+
+static char **exec_argv(char **argv, const char *target)
+{
+	int argc, i, found = 0;
+	char **r;
+
+	for (argc = 0; argv[argc]; argc++)
+		;
+	if ((r = calloc(argc + 2, sizeof *r)) == NULL)
+		return NULL;
+	for (i = 0; i < argc; i++) {
+		char *s = substitute(argv[i], target);
+		found |= s != NULL;
+		r[i] = s ? s : argv[i];	/* leaked, the process execs or exits */
+	}
+	if (!found)
+		r[argc] = (char *) target;
+	return r;
+}
+
+/* a line of output saying why a target could not be run */
+static void start_failed(struct target *t, const char *func)
+{
+	const char *msg = strerror(errno);
+
+	t->size = strlen(func) + strlen(msg) + 4;
+	if ((t->out = malloc(t->size)) != NULL)
+		t->len = sprintf(t->out, "%s: %s\n", func, msg);
+	t->status = 127 << 8;	/* as the shell has it */
+	t->fd = -1;
+	t->start = t->end = watch_time_usec();
+}
+
+static int start(const struct watch_ctx *w, struct target *t, const char *target)
+{
+	char *command = NULL, **argv = NULL;
+	int pipefd[2];
+
+	if (w->opt.exec ? (argv = exec_argv(w->opt.argv, target)) == NULL
+	    : (command = shell_command(w->opt.command, target)) == NULL) {
+		start_failed(t, "malloc");
+		return -1;
+	}
+	if (pipe(pipefd) < 0) {
+		start_failed(t, "pipe");
+		free(command);
+		free(argv);
+		return -1;
+	}
+	t->start = watch_time_usec();
+	if ((t->pid = fork()) < 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		start_failed(t, "fork");
+		free(command);
+		free(argv);
+		return -1;
+	}
+	if (t->pid == 0) {
+		close(pipefd[0]);
+		if (dup2(pipefd[1], 1) < 0 || dup2(1, 2) < 0) {
+			perror("dup2");
+			_exit(3);
+		}
+		close(pipefd[1]);
+		if (argv) {
+			execvp(argv[0], argv);
+			perror("exec");
+			_exit(4);
+		}
+		execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+		perror("sh");
+		_exit(127);
+	}
+	close(pipefd[1]);
+	free(command);
+	free(argv);
+	t->fd = pipefd[0];
+	return 0;
+}
+
+/* read what is there; the target is done at end of file, or once it has
+ * written cap bytes, when it gets SIGPIPE as the command itself would */
+static void collect(struct target *t, size_t cap)
+{
+	size_t room;
+	ssize_t n;
+
+	if (t->len == t->size && t->size < cap) {
+		size_t size = t->size ? t->size * 2 : 4096;
+		char *p = realloc(t->out, size < cap ? size : cap);
+		if (p) {
+			t->out = p;
+			t->size = size < cap ? size : cap;
+		}
+	}
+	if ((room = t->size - t->len) > 0) {	/* else cut off */
+		n = read(t->fd, t->out + t->len, room);
+		if (n < 0 && errno == EINTR)
+			return;
+		if (n > 0) {
+			t->len += n;
+			return;
+		}
+	}
+	close(t->fd);
+	t->fd = -1;
+	while (waitpid(t->pid, &t->status, 0) < 0 && errno == EINTR)
+		;
+	t->end = watch_time_usec();
+}
+
+static void write_section(const struct target *t, const char *target,
+    int *rows)
+{
+	int lines = 0;
+	const char *p, *end = t->out + t->len;
+
+	printf("==> %s <== ", target);
+	if (WIFEXITED(t->status))
+		printf("exit %d", WEXITSTATUS(t->status));
+	else
+		printf("signal %d", WTERMSIG(t->status));
+	printf(", %.1fs\n", (double) (t->end - t->start) / USECS_PER_SEC);
+	fwrite(t->out, 1, t->len, stdout);
+	for (p = t->out; p < end && (p = memchr(p, '\n', end - p)) != NULL; p++)
+		lines++;
+	if (t->len && end[-1] != '\n') {
+		putchar('\n');
+		lines++;
+	}
+	if (rows) {
+		for (; lines < *rows; lines++)
+			putchar('\n');
+		*rows = lines;
+	}
+}
+
+int each_run(const struct watch_ctx *w, size_t cap)
+{
+	int n = w->opt.each_count, jobs = w->opt.jobs > 0 ? w->opt.jobs : EACH_JOBS;
+	int next = 0, running = 0, status = 0, i;
+	struct target *t = calloc(n, sizeof *t);
+	struct pollfd *pfd = calloc(jobs, sizeof *pfd);
+	int *which = calloc(jobs, sizeof *which);
+
+	if (!t || !pfd || !which) {
+		perror("malloc");
+		return 1;
+	}
+	/* watch's handlers are no use here, it cleans up after itself */
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+	while (next < n || running) {
+		int nfds = 0;
+
+		for (; running < jobs && next < n; next++)
+			if (start(w, &t[next], w->opt.each[next]) == 0)
+				running++;
+		for (i = 0; i < next; i++)
+			if (t[i].fd >= 0) {
+				pfd[nfds].fd = t[i].fd;
+				pfd[nfds].events = POLLIN;
+				which[nfds++] = i;
+			}
+		if (!nfds)
+			continue;
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+		for (i = 0; i < nfds; i++)
+			if (pfd[i].revents) {
+				collect(&t[which[i]], cap);
+				if (t[which[i]].fd < 0)
+					running--;
+			}
+	}
+
+	for (i = 0; i < n; i++) {
+		write_section(&t[i], w->opt.each[i],
+		    w->each_rows ? &w->each_rows[i] : NULL);
+		/* the first target that failed decides, as for one command */
+		if (!status && t[i].status)
+			status = WIFEXITED(t[i].status) ? WEXITSTATUS(t[i].status) : 1;
+	}
+	fflush(stdout);
+	return status;
+}
@@ -0,0 +1,14 @@
+/* each.h -- the fan-out behind --each; private to the library */
+
+#ifndef WATCH_EACH_H
+#define WATCH_EACH_H
+
+#include <stddef.h>
+#include "libwatch.h"
+
+/* in the child of watch_spawn(): run the command for every target and
+ * write their outputs to stdout, at most cap bytes of each; returns the
+ * exit status for the child */
+extern int each_run(const struct watch_ctx *w, size_t cap);
+
+#endif
@@ -0,0 +1,121 @@
+/* guard.c -- the probe behind --guard and --guard-stat
+ *
+ * Before a run the probe is taken: the output and exit status of a cheap
+ * command, and the device, inode, size and times of some files, hashed
+ * together.  The command proper is only run when that hash differs from
+ * the one taken before its last run.  The probe command is read and
+ * reaped without blocking, like the command proper; stat() is quick.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "guard.h"
+#include "linestore.h"
+
+static unsigned long long hash_value(unsigned long long h, long long v)
+{
+	return watch_lines_hash_more(h, &v, sizeof v);
+}
+
+static unsigned long long probe_path(const char *path, unsigned long long h)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)	/* gone, or not there yet */
+		return hash_value(h, -errno);
+	h = hash_value(h, st.st_dev);
+	h = hash_value(h, st.st_ino);
+	h = hash_value(h, st.st_size);
+	h = hash_value(h, st.st_mtime);
+	h = hash_value(h, st.st_ctime);
+#ifdef __linux__
+	h = hash_value(h, st.st_mtim.tv_nsec);	/* within the same second */
+	h = hash_value(h, st.st_ctim.tv_nsec);
+#endif
+	return h;
+}
+
+int guard_start(struct watch_ctx *w)
+{
+	int pipefd[2];
+
+	w->guard_sum = watch_lines_hash(NULL, 0);
+	if (w->opt.guard == NULL)	/* only paths */
+		return 0;
+	if (pipe(pipefd) < 0)
+		return -1;
+	fflush(stdout);
+	fflush(stderr);
+	if ((w->guard_child = fork()) < 0) {
+		w->guard_child = 0;
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+	if (w->guard_child == 0) {
+		close(pipefd[0]);
+		if (dup2(pipefd[1], 1) < 0 || dup2(1, 2) < 0)
+			_exit(3);
+		close(pipefd[1]);
+		execl("/bin/sh", "sh", "-c", w->opt.guard, (char *) NULL);
+		_exit(127);
+	}
+	close(pipefd[1]);
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+	w->guard_fd = pipefd[0];
+	return 0;
+}
+
+int guard_poll(struct watch_ctx *w, unsigned long long *hash)
+{
+	char buf[4096];
+	int status, i;
+	pid_t pid;
+
+	while (w->guard_fd >= 0) {
+		ssize_t n = read(w->guard_fd, buf, sizeof buf);
+
+		if (n > 0) {
+			w->guard_sum = watch_lines_hash_more(w->guard_sum, buf, n);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		close(w->guard_fd);	/* the end, or as much as can be read */
+		w->guard_fd = -1;
+	}
+	if (w->guard_child) {
+		pid = waitpid(w->guard_child, &status, WNOHANG);
+		if (pid == 0 || (pid < 0 && errno == EINTR))
+			return 0;
+		w->guard_child = 0;
+		/* not ours to wait for after all: the probe goes without it */
+		w->guard_sum = hash_value(w->guard_sum, pid < 0 ? -errno : status);
+	}
+	for (i = 0; i < w->opt.guard_path_count; i++)
+		w->guard_sum = probe_path(w->opt.guard_paths[i], w->guard_sum);
+	*hash = w->guard_sum;
+	return 1;
+}
+
+void guard_stop(struct watch_ctx *w)
+{
+	if (w->guard_fd >= 0) {
+		close(w->guard_fd);
+		w->guard_fd = -1;
+	}
+	if (w->guard_child) {
+		kill(w->guard_child, SIGTERM);
+		waitpid(w->guard_child, NULL, 0);
+		w->guard_child = 0;
+	}
+}
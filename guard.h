@@ -0,0 +1,21 @@
+/* guard.h -- the probe behind --guard; private to the library */
+
+#ifndef WATCH_GUARD_H
+#define WATCH_GUARD_H
+
+#include "libwatch.h"
+
+/* start taking the probe, spawning the guard command with its output to
+ * be read from w->guard_fd; returns 0, or -1 with errno set when the
+ * command could not be run */
+extern int guard_start(struct watch_ctx *w);
+
+/* carry on without blocking: returns 0 while the command runs, or 1 with
+ * *hash the hash of what it wrote and how it exited, and of what stat()
+ * says of the guarded paths */
+extern int guard_poll(struct watch_ctx *w, unsigned long long *hash);
+
+/* give up a probe in progress */
+extern void guard_stop(struct watch_ctx *w);
+
+#endif
@@ -0,0 +1,190 @@
+/* history.c -- the outputs of past runs, for --history
+ *
+ * Outputs are kept in a line store (see linestore.h): each line is
+ * stored once however many outputs it appears in, and an output is
+ * stored as the ids of blocks of HISTORY_BLOCK line ids, the blocks
+ * stored in the same store, so outputs that share most of their lines
+ * share most of their blocks too.  Runs in a row with the same output
+ * share one entry.
+ *
+ * A block holds one reference to each of its lines, taken when it is
+ * first stored (or stored again after falling out of use) and dropped
+ * when the last output using it goes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+#include "linestore.h"
+
+#define HISTORY_BLOCK 16	/* line ids per block */
+#define HISTORY_GARBAGE_MIN (64 * 1024)	/* not worth compacting before */
+
+struct output {
+	watch_line_id *blocks;
+	size_t nblocks, blocks_size;
+	int partial;		/* the last line has no newline */
+	unsigned long runs;	/* in a row with this output */
+};
+
+static struct watch_lines *store;
+static struct output *ring;
+static unsigned long ring_size, ring_len, ring_head;	/* head: the newest */
+static watch_line_id *ids, *blocks;		/* scratch */
+static size_t ids_size, blocks_size;
+
+int history_init(unsigned long outputs)
+{
+	if ((store = watch_lines_new()) == NULL
+	    || (ring = calloc(outputs, sizeof *ring)) == NULL)
+		return -1;
+	ring_size = outputs;
+	return 0;
+}
+
+static void release_lines(watch_line_id block)
+{
+	const watch_line_id *line;
+	size_t len, i;
+
+	line = (const watch_line_id *) watch_lines_get(store, block, &len);
+	for (i = 0; i < len / sizeof *line; i++)
+		watch_lines_unref(store, line[i]);
+}
+
+static void release(struct output *o)
+{
+	size_t i;
+
+	for (i = 0; i < o->nblocks; i++)
+		if (!watch_lines_unref(store, o->blocks[i]))
+			release_lines(o->blocks[i]);
+	o->nblocks = 0;
+}
+
+static int grow(watch_line_id **p, size_t *size, size_t n)
+{
+	watch_line_id *q;
+
+	if (n <= *size)
+		return 0;
+	if ((q = realloc(*p, n * sizeof *q)) == NULL)
+		return -1;
+	*p = q;
+	*size = n;
+	return 0;
+}
+
+void history_add(const struct watch_ctx *w)
+{
+	const char *p = w->capture, *end = w->capture + w->capture_len;
+	size_t nlines = 0, nblocks, i, j;
+	int partial = w->capture_len && end[-1] != '\n';
+	struct output *o;
+
+	if (!store)
+		return;
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		size_t len = (nl ? nl : end) - p;
+
+		if (grow(&ids, &ids_size, nlines + 1) < 0)
+			goto fail_lines;
+		if (!(ids[nlines] = watch_lines_intern(store, p, len,
+		    watch_lines_hash(p, len))))
+			goto fail_lines;
+		nlines++;
+		p += len + 1;
+	}
+
+	nblocks = (nlines + HISTORY_BLOCK - 1) / HISTORY_BLOCK;
+	if (grow(&blocks, &blocks_size, nblocks) < 0)
+		goto fail_lines;
+	for (i = 0; i < nblocks; i++) {
+		const char *b = (const char *) (ids + i * HISTORY_BLOCK);
+		size_t len = (nlines - i * HISTORY_BLOCK < HISTORY_BLOCK
+		    ? nlines - i * HISTORY_BLOCK : HISTORY_BLOCK) * sizeof *ids;
+
+		if (!(blocks[i] = watch_lines_intern(store, b, len,
+		    watch_lines_hash(b, len)))) {
+			for (j = i * HISTORY_BLOCK; j < nlines; j++)
+				watch_lines_unref(store, ids[j]);
+			nblocks = i;
+			goto fail_blocks;
+		}
+		/* a block in use already has its own references */
+		if (watch_lines_refs(store, blocks[i]) > 1)
+			for (j = 0; j < len / sizeof *ids; j++)
+				watch_lines_unref(store, ids[i * HISTORY_BLOCK + j]);
+	}
+
+	o = &ring[ring_head];
+	if (ring_len && o->partial == partial && o->nblocks == nblocks
+	    && !memcmp(o->blocks, blocks, nblocks * sizeof *blocks)) {
+		for (i = 0; i < nblocks; i++)
+			watch_lines_unref(store, blocks[i]);
+		o->runs++;
+		return;
+	}
+
+	if (ring_len)
+		ring_head = (ring_head + 1) % ring_size;
+	o = &ring[ring_head];
+	if (ring_len == ring_size)
+		release(o);	/* the oldest */
+	else
+		ring_len++;
+	o->runs = 1;
+	if (grow(&o->blocks, &o->blocks_size, nblocks) < 0)
+		goto fail_blocks;	/* the slot stays, empty */
+	memcpy(o->blocks, blocks, nblocks * sizeof *blocks);
+	o->nblocks = nblocks;
+	o->partial = partial;
+
+	/* forget lines that fell out of use once they take more room than
+	 * the lines still in use */
+	if (watch_lines_garbage(store) > HISTORY_GARBAGE_MIN
+	    && watch_lines_garbage(store) * 2 > watch_lines_bytes(store))
+		watch_lines_compact(store);
+	return;
+
+fail_blocks:
+	for (i = 0; i < nblocks; i++)
+		if (!watch_lines_unref(store, blocks[i]))
+			release_lines(blocks[i]);
+	return;
+fail_lines:
+	for (i = 0; i < nlines; i++)
+		watch_lines_unref(store, ids[i]);
+}
+
+int history_write(FILE *fp, unsigned long ago)
+{
+	unsigned long n = 0, i;
+	const struct output *o = NULL;
+	size_t b;
+
+	for (i = 0; i < ring_len; i++) {
+		o = &ring[(ring_head + ring_size - i) % ring_size];
+		if (ago < n + o->runs)
+			break;
+		n += o->runs;
+	}
+	if (i == ring_len)
+		return -1;
+	for (b = 0; b < o->nblocks; b++) {
+		const watch_line_id *line;
+		size_t len, l;
+
+		line = (const watch_line_id *) watch_lines_get(store, o->blocks[b], &len);
+		for (l = 0; l < len / sizeof *line; l++) {
+			size_t linelen;
+			const char *p = watch_lines_get(store, line[l], &linelen);
+
+			fwrite(p, 1, linelen, fp);
+			if (!o->partial || b + 1 < o->nblocks || l + 1 < len / sizeof *line)
+				putc('\n', fp);
+		}
+	}
+	return ferror(fp) ? -1 : 0;
+}
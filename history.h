@@ -0,0 +1,17 @@
+#ifndef WATCH_HISTORY_H
+#define WATCH_HISTORY_H
+
+#include <stdio.h>
+#include "libwatch.h"
+
+/* keep the outputs of the last runs, up to this many distinct ones */
+extern int history_init(unsigned long outputs);
+
+/* the run that just finished */
+extern void history_add(const struct watch_ctx *w);
+
+/* write the output of the run this many runs before the last; -1 if it
+ * is no longer kept */
+extern int history_write(FILE *fp, unsigned long ago);
+
+#endif
@@ -0,0 +1,1559 @@
+/* libwatch.c -- run a command repeatedly and turn its output into frames
+ *
+ * This is the core of watch, moved out of main() so it can be driven from
+ * other event loops; see libwatch.h for the interface.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "procps.h"
+#include "libwatch.h"
+#include "pool.h"
+#include "each.h"
+#include "guard.h"
+#include "budget.h"
+
+#ifdef FORCE_8BIT
+#undef isprint
+#define isprint(x) ( (x>=' '&&x<='~') || (x>=0xa0) )
+#endif
+
+#define MAX_ANSIBUF 10
+#define BYTES_PER_CELL 16	/* stop reading after this much output per cell */
+#define REAP_DELAY_MAX (50 * 1000ull)	/* usec between waitpid() polls */
+#define IDLE_STRETCH_AFTER (60 * USECS_PER_SEC)	/* unchanged this long... */
+#define IDLE_STRETCH_MAX 3	/* ...doubles the interval, up to 2^this */
+#define TIMER_SLACK_MAX 500000000ul	/* nsec */
+#define PARALLEL_MIN_CELLS 32768	/* compare bigger screens on the pool */
+#define BAND_CELLS 8192		/* about this many cells per piece */
+#define PARALLEL_MIN_BYTES (256 * 1024)	/* hash bigger outputs on the pool */
+#define HASH_CHUNK (64 * 1024)
+#define HASH_CHUNKS 64		/* beyond that, bigger chunks */
+#define SCROLL_MIN_ROWS 2	/* moved rows worth scrolling for */
+
+watch_usec_t watch_time_usec(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return USECS_PER_SEC*now.tv_sec + now.tv_usec;
+}
+
+static watch_usec_t wall_clock(void *notused)
+{
+	(void) notused;
+	return watch_time_usec();
+}
+
+watch_usec_t watch_now(const struct watch_ctx *w)
+{
+	return w->clock.now(w->clock.arg);
+}
+
+static int alloc_screen(struct watch_ctx *w, int height, int width)
+{
+	size_t n = (size_t) height * width;
+	struct watch_cell *cells = calloc(n, sizeof *cells);
+	struct watch_cell *prev = calloc(n, sizeof *prev);
+	unsigned char *dirty = malloc(height);
+	unsigned long long *row_hash = malloc(height * sizeof *row_hash);
+	unsigned long long *prev_hash = malloc(height * sizeof *prev_hash);
+	int ring_size = height - w->opt.show_title + 1;
+	size_t *ring = w->opt.tail ? malloc(ring_size * sizeof *ring) : NULL;
+
+	if (!cells || !prev || !dirty || !row_hash || !prev_hash
+	    || (w->opt.tail && !ring)) {
+		free(cells);
+		free(prev);
+		free(dirty);
+		free(row_hash);
+		free(prev_hash);
+		free(ring);
+		return -1;
+	}
+	free(w->cells);
+	free(w->prev);
+	free(w->dirty);
+	free(w->row_hash);
+	free(w->prev_hash);
+	free(w->tail_ring);
+	w->cells = cells;
+	w->prev = prev;
+	w->dirty = dirty;
+	w->row_hash = row_hash;
+	w->prev_hash = prev_hash;
+	w->tail_ring = ring;
+	w->tail_ring_size = ring_size;
+	w->tail_ring_len = w->tail_head = 0;
+	w->height = height;
+	w->width = width;
+	w->first_screen = 1;
+	w->rows_hashed = 0;
+	w->scroll_by = 0;
+	return 0;
+}
+
+// convert to wide for printing purposes
+static int set_wcommand(struct watch_ctx *w, const char *command)
+{
+	int characters = mbstowcs(NULL, command, 0);
+	wchar_t *wcommand;
+
+	if (characters < 0) {
+		errno = EILSEQ;
+		return -1;
+	}
+	wcommand = (wchar_t*)malloc((characters+1) * sizeof(wchar_t));
+	if (wcommand == NULL)
+		return -1;
+	mbstowcs(wcommand, command, characters+1);
+	free(w->wcommand);
+	w->wcommand = wcommand;
+	w->wcommand_characters = characters;
+	w->wcommand_columns = wcswidth(wcommand, -1);
+	return 0;
+}
+
+struct watch_ctx *watch_new(const struct watch_options *opt, int height, int width)
+{
+	struct watch_ctx *w = calloc(1, sizeof *w);
+
+	if (w == NULL)
+		return NULL;
+	w->opt = *opt;
+	w->clock.now = wall_clock;
+	w->fd = -1;
+	w->guard_fd = -1;
+	w->state = WATCH_IDLE;
+
+	if (set_wcommand(w, opt->command) < 0)
+		goto fail;
+	if (alloc_screen(w, height, width) < 0)
+		goto fail;
+	if (opt->timeline
+	    && (w->runs = calloc(WATCH_TIMELINE_RUNS, sizeof *w->runs)) == NULL)
+		goto fail;
+	if (opt->each_count) {
+		/* without it sections just are not padded */
+		w->each_rows = mmap(NULL, opt->each_count * sizeof *w->each_rows,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (w->each_rows == MAP_FAILED)
+			w->each_rows = NULL;
+	}
+#ifdef PR_SET_TIMERSLACK
+	/* let the kernel batch our timers with others, by up to 5% */
+	if (opt->power_save) {
+		unsigned long slack = opt->interval * 1e9 / 20;
+		prctl(PR_SET_TIMERSLACK, slack < TIMER_SLACK_MAX ? slack : TIMER_SLACK_MAX);
+	}
+#endif
+	return w;
+
+fail:
+	watch_free(w);
+	return NULL;
+}
+
+void watch_free(struct watch_ctx *w)
+{
+	if (w == NULL)
+		return;
+	if (w->fd >= 0)
+		close(w->fd);
+	guard_stop(w);
+	free(w->wcommand);
+	free(w->cells);
+	free(w->prev);
+	free(w->dirty);
+	free(w->row_hash);
+	free(w->prev_hash);
+	free(w->tail_ring);
+	free(w->capture);
+	free(w->baseline);
+	free(w->line_hashes);
+	free(w->runs);
+	budget_close(w->budget);
+	pool_free(w->pool);
+	if (w->each_rows)
+		munmap(w->each_rows, w->opt.each_count * sizeof *w->each_rows);
+	free(w);
+}
+
+void watch_set_sink(struct watch_ctx *w, const struct watch_sink *sink)
+{
+	w->sink = *sink;
+}
+
+void watch_set_clock(struct watch_ctx *w, const struct watch_clock *clock)
+{
+	w->clock = *clock;
+}
+
+/*
+ * Header
+ */
+
+static void put_row_str(struct watch_ctx *w, int y, int x, const char *s)
+{
+	struct watch_cell *row = watch_row(w, y);
+	for (; *s && x < w->width; s++, x++)
+		if (x >= 0)
+			row[x].ch = (unsigned char) *s;
+}
+
+static void put_str(struct watch_ctx *w, int x, const char *s)
+{
+	put_row_str(w, 0, x, s);
+}
+
+static void put_wstr(struct watch_ctx *w, int x, const wchar_t *s, int n)
+{
+	struct watch_cell *row = watch_row(w, 0);
+	for (; n-- > 0 && *s && x < w->width; s++) {
+		int cw = wcwidth(*s);
+		if (cw < 0)
+			continue;
+		if (cw == 0) {
+			if (x > 0)
+				row[x - 1].comb = *s;
+			continue;
+		}
+		if (x + cw > w->width)
+			break;
+		row[x].ch = *s;
+		if (cw == 2)
+			row[x + 1].ch = WATCH_WIDE_CONT;
+		x += cw;
+	}
+}
+
+static int guarded(const struct watch_ctx *w)
+{
+	return w->opt.guard || w->opt.guard_path_count;
+}
+
+static const struct watch_run *run_at(const struct watch_ctx *w, int i)
+{
+	return &w->runs[(w->runs_head + i) % WATCH_TIMELINE_RUNS];
+}
+
+/* the shortest, total and longest of the last n runs */
+static void run_stats(const struct watch_ctx *w, int n, watch_usec_t *min,
+    watch_usec_t *sum, watch_usec_t *max)
+{
+	int i;
+
+	*min = *sum = *max = 0;
+	for (i = w->runs_len - n; i < w->runs_len; i++) {
+		watch_usec_t d = run_at(w, i)->duration;
+		if (i == w->runs_len - n || d < *min)
+			*min = d;
+		if (d > *max)
+			*max = d;
+		*sum += d;
+	}
+}
+
+/* on the header's second row, a bar per run, newest on the right: as
+ * high as the run was long next to the longest shown, green when it
+ * exited 0 and red when not; then the shortest, mean and longest of them */
+static void draw_timeline(struct watch_ctx *w)
+{
+	static const char ramp[] = "._-~=+*#";	/* without block elements */
+	struct watch_cell *row = watch_row(w, 1);
+	watch_usec_t min, sum, max;
+	int blocks = wcwidth(0x2581) == 1;	/* LOWER ONE EIGHTH BLOCK */
+	int n = w->runs_len < w->width ? w->runs_len : w->width;
+	int i, cols;
+	char stats[80];
+
+	if (!n || w->height < 2)
+		return;
+	for (;;) {	/* again for fewer runs when not all of them fit */
+		run_stats(w, n, &min, &sum, &max);
+		cols = w->width - snprintf(stats, sizeof stats,
+		    " min %.2fs avg %.2fs max %.2fs", (double) min / USECS_PER_SEC,
+		    (double) sum / n / USECS_PER_SEC, (double) max / USECS_PER_SEC);
+		if (cols < 1)
+			return;
+		if (n <= cols)
+			break;
+		n = cols;
+	}
+	for (i = 0; i < n; i++) {
+		const struct watch_run *r = run_at(w, w->runs_len - n + i);
+		int level = max ? r->duration * 7 / max : 0;
+		int ok = WIFEXITED(r->status) && !WEXITSTATUS(r->status);
+
+		row[i].ch = blocks ? 0x2581 + level : (wchar_t) ramp[level];
+		row[i].color = ok ? 3 : 2;	/* as ANSI 32 and 31 */
+		row[i].attr = ok ? 0 : WATCH_BOLD;
+	}
+	put_row_str(w, 1, cols, stats);
+}
+
+static void draw_header(struct watch_ctx *w)
+{
+	// left justify interval and command,
+	// right justify time, clipping all to fit window width
+	time_t t = w->run_start / USECS_PER_SEC;
+	struct tm tm;
+	char ts[32];	/* ctime() strdup()s $TZ on every call */
+	int tsl = strlen(asctime_r(localtime_r(&t, &tm), ts));
+	int width = w->width;
+	char header[128];	/* no allocation per frame */
+	int hlen = snprintf(header, sizeof header, "Every %.1fs", w->opt.interval);
+
+	if (w->baseline)
+		hlen += snprintf(header + hlen, sizeof header - hlen,
+		    " (baseline +%lu -%lu)", w->drift_added, w->drift_removed);
+	if (guarded(w))
+		hlen += snprintf(header + hlen, sizeof header - hlen,
+		    " (guard hit %lu miss %lu)", w->guard_hits, w->guard_misses);
+	hlen += snprintf(header + hlen, sizeof header - hlen, ": ");
+
+	ts[tsl - 1] = '\0';	/* no newline, the row is already cleared */
+
+	// the rules:
+	//   width < tsl : print nothing
+	//   width < tsl + hlen + 1: print ts
+	//   width = tsl + hlen + 1: print header, ts
+	//   width < tsl + hlen + 4: print header, ..., ts
+	//   width < tsl + hlen + wcommand_columns: print header, truncated wcommand, ..., ts
+	//   width > "": print header, wcomand, ts
+	// this is slightly different from how it used to be
+	if(width >= tsl) {
+		if(width >= tsl + hlen + 1) {
+			put_str(w, 0, header);
+			if(width >= tsl + hlen + 2) {
+				if(width < tsl + hlen + 4) {
+					put_str(w, width - tsl - 4, "...  ");
+				}else{
+					if(width < tsl + hlen + w->wcommand_columns) {
+						// print truncated
+						int avail_columns = width - tsl - hlen;
+						int using_columns = w->wcommand_columns;
+						int using_characters = w->wcommand_characters;
+						while(using_columns > avail_columns - 4) {
+							using_characters--;
+							using_columns = wcswidth(w->wcommand, using_characters);
+						}
+						put_wstr(w, hlen, w->wcommand, using_characters);
+						put_str(w, width - tsl - 4, "... ");
+					}else{
+						put_wstr(w, hlen, w->wcommand, w->wcommand_characters);
+					}
+				}
+			}
+		}
+		put_str(w, width - tsl + 1, ts);
+	}
+	if (w->runs)
+		draw_timeline(w);
+}
+
+/*
+ * Layout
+ */
+
+/* FNV-1a, to notice output that did not change, and
+ * lines that are not in the baseline */
+static unsigned long long hash_bytes(const char *p, size_t len)
+{
+	unsigned long long h = 14695981039346656037ull;
+
+	while (len--) {
+		h ^= (unsigned char) *p++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static int compare_hashes(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* the hash of every line of the output, in order, into h; returns the
+ * number of lines */
+static size_t hash_lines(const char *p, size_t len, unsigned long long *h)
+{
+	const char *end = p + len;
+	size_t n = 0;
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		h[n++] = hash_bytes(p, (nl ? nl : end) - p);
+		p = nl ? nl + 1 : end;
+	}
+	return n;
+}
+
+static size_t count_lines_in(const char *p, size_t len)
+{
+	size_t n = 0;
+	const char *end = p + len;
+
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+		n++;
+		p++;
+	}
+	return n + (len && end[-1] != '\n');
+}
+
+/* whether the line starting at p is in the baseline */
+static int in_baseline(const struct watch_ctx *w, const char *p, const char *end)
+{
+	const char *nl = memchr(p, '\n', end - p);
+	unsigned long long h = hash_bytes(p, (nl ? nl : end) - p);
+
+	return bsearch(&h, w->baseline, w->baseline_lines, sizeof h,
+	    compare_hashes) != NULL;
+}
+
+struct reader {
+	const char *p, *end;
+	mbstate_t ps;
+};
+
+// read a wide character from the captured output
+static wint_t next_wc(struct reader *r)
+{
+	while (r->p < r->end) {
+		wchar_t wc;
+		size_t n = mbrtowc(&wc, r->p, r->end - r->p, &r->ps);
+		if (n == (size_t) -2) {	/* cut off at the end */
+			r->p = r->end;
+			break;
+		}
+		if (n == (size_t) -1) {	/* not in this locale, drop a byte */
+			memset(&r->ps, 0, sizeof r->ps);
+			r->p++;
+			continue;
+		}
+		r->p += n ? n : 1;
+		return wc;
+	}
+	return WEOF;
+}
+
+static void set_ansi_attribute(const int attrib, unsigned char *attr,
+    unsigned char *color)
+{
+	switch (attrib)
+	{
+	case 0:
+		*attr = 0;
+		*color = 0;
+		return;
+	case 1:
+		*attr |= WATCH_BOLD;
+		return;
+	case 22:
+		*attr &= ~WATCH_BOLD;
+		return;
+	case 39:
+		*color = 0;
+		return;
+	}
+	if (attrib >= 30 && attrib <= 37)
+		*color = attrib-29;
+}
+
+/* after an ESC: apply a CSI ... m color sequence, or drop what looked
+ * like the start of one */
+static void process_ansi(struct reader *r, unsigned char *attr,
+    unsigned char *color)
+{
+	const char *p = r->p, *end;
+	int i;
+
+	if (p >= r->end || *p != '[')
+		return;
+	for (end = p + 1, i = 0; end < r->end && i < MAX_ANSIBUF; end++, i++)
+		if (!isdigit((unsigned char) *end) && *end != ';')
+			break;
+	if (end >= r->end || *end != 'm') { //COLOUR SEQUENCE ENDS in 'm'
+		r->p = end;
+		return;
+	}
+	/* an empty parameter means 0, as in "ESC[m" */
+	for (p++; p <= end; p++) {
+		char *next;
+		long num = strtol(p, &next, 10);
+		set_ansi_attribute((int) num, attr, color);
+		p = next;
+	}
+	r->p = end + 1;
+}
+
+static void clear_rows(struct watch_ctx *w, int from, int to)
+{
+	struct watch_cell blank = { L' ', 0, 0, 0 };
+	size_t i;
+
+	for (i = (size_t) from * w->width; i < (size_t) to * w->width; i++)
+		w->cells[i] = blank;
+}
+
+/* lay the captured output from from on out below the header, the way
+ * watch always has: long lines wrap, tabs stop every 8 columns,
+ * non-printing characters are dropped, and a newline right after a line
+ * that filled the width does not start another one; returns whether some
+ * of the output did not fit */
+static int layout(struct watch_ctx *w, const char *from)
+{
+	struct reader r;
+	unsigned char attr = 0, color = 0;
+	int x, y;
+	int oldeolseen = 1;
+	const char *next_line;	/* where the next output line starts */
+	unsigned char drifted = 0;	/* WATCH_STANDOUT for a line not in
+					 * the baseline */
+
+	memset(&r, 0, sizeof r);
+	r.p = from;
+	r.end = w->capture + w->capture_len;
+	next_line = r.p;
+
+	for (y = w->opt.show_title; y < w->height; y++) {
+		int eolseen = 0, tabpending = 0;
+		wint_t carry = WEOF;
+		for (x = 0; x < w->width; x++) {
+			struct watch_cell *cell;
+			wint_t c = L' ';
+			int cw;
+
+			if (!eolseen) {
+				/* if there is a tab pending, just spit spaces until the
+				   next stop instead of reading characters */
+				if (!tabpending)
+					do {
+						if(carry == WEOF) {
+							if (w->baseline && r.p >= next_line) {
+								/* past the end, nothing is */
+								drifted = r.p < r.end && !in_baseline(w, r.p, r.end)
+								    ? WATCH_STANDOUT : 0;
+								next_line = memchr(r.p, '\n', r.end - r.p);
+								next_line = next_line ? next_line + 1 : r.end;
+							}
+							c = next_wc(&r);
+						}else{
+							c = carry;
+							carry = WEOF;
+						}
+					}while (c != WEOF
+					       && ((c < 128 && !isprint(c)) || wcwidth(c) < 0)
+					       && c != L'\n'
+					       && c != L'\t'
+					       && (c != L'\033' || !w->opt.color));
+				if (c == L'\033' && w->opt.color) {
+					x--;
+					process_ansi(&r, &attr, &color);
+					continue;
+				}
+				if (c == L'\n')
+					if (!oldeolseen && x == 0) {
+						x = -1;
+						continue;
+					} else
+						eolseen = 1;
+				else if (c == L'\t')
+					tabpending = 1;
+				if (x==w->width-1 && wcwidth(c)==2) {
+					if (++y >= w->height)
+						return 1;
+					x = -1; //process this double-width
+					carry = c; //character on the next line
+					continue; //because it won't fit here
+				}
+				if (c == WEOF || c == L'\n' || c == L'\t')
+					c = L' ';
+				if (tabpending && (((x + 1) % 8) == 0))
+					tabpending = 0;
+			}
+			cw = wcwidth(c);
+			if (cw == 0) {
+				/* combining: goes with the character before it */
+				if (x > 0)
+					watch_row(w, y)[x - 1].comb = c;
+				x--;
+				continue;
+			}
+			cell = &watch_row(w, y)[x];
+			cell->ch = c;
+			if (!eolseen) {
+				cell->attr = attr | drifted;
+				cell->color = color;
+			}
+			if (cw == 2) {
+				cell[1] = cell[0];
+				cell[1].ch = WATCH_WIDE_CONT;
+				x++;
+			}
+		}
+		oldeolseen = eolseen;
+	}
+	/* what is left is at most the newline after a full last row */
+	return r.p < r.end && !(r.p + 1 == r.end && *r.p == '\n');
+}
+
+/* the workers, started the first time a frame is big enough to need them */
+static struct watch_pool *get_pool(struct watch_ctx *w)
+{
+	if (!w->pool && !w->pool_tried) {
+		long cpus = w->opt.threads ? w->opt.threads
+		    : sysconf(_SC_NPROCESSORS_ONLN);
+		w->pool_tried = 1;
+		if (cpus > 1)
+			w->pool = pool_new(cpus - 1);
+	}
+	return w->pool;
+}
+
+struct compare_job {
+	struct watch_ctx *w;
+	int rows;		/* per piece */
+	int redraw_all;
+};
+
+/* highlight what --differences says changed in a band of rows, and mark
+ * the rows that differ from what was drawn */
+static void compare_rows(void *arg, int piece)
+{
+	struct compare_job *j = arg;
+	struct watch_ctx *w = j->w;
+	size_t rowbytes = w->width * sizeof *w->cells;
+	int diff = w->opt.differences && !w->first_screen && !w->baseline;
+	int y = piece * j->rows, end = y + j->rows, changed = 0, x;
+
+	if (end > w->height)
+		end = w->height;
+	for (; y < end; y++) {
+		struct watch_cell *c = watch_row(w, y);
+		const struct watch_cell *old = w->prev + (size_t) y * w->width;
+
+		for (x = 0; diff && y >= w->opt.show_title && x < w->width; x++) {
+			if (c[x].ch == WATCH_WIDE_CONT) {	/* goes with its left half */
+				c[x].attr = (c[x].attr & ~WATCH_STANDOUT)
+				    | (c[x - 1].attr & WATCH_STANDOUT);
+				continue;
+			}
+			if (c[x].ch != old[x].ch
+			    || (w->opt.cumulative && (old[x].attr & WATCH_STANDOUT))) {
+				c[x].attr |= WATCH_STANDOUT;
+				changed++;
+			}
+		}
+		w->dirty[y] = j->redraw_all || memcmp(c, old, rowbytes);
+		w->row_hash[y] = hash_bytes((const char *) c, rowbytes);
+	}
+	if (changed)
+		__atomic_fetch_add(&w->changed, changed, __ATOMIC_RELAXED);
+}
+
+static void compare(struct watch_ctx *w, int redraw_all)
+{
+	struct compare_job j;
+	size_t cells = (size_t) w->height * w->width;
+
+	j.w = w;
+	j.rows = BAND_CELLS / w->width + 1;
+	j.redraw_all = redraw_all;
+	w->changed = 0;
+	pool_run(cells >= PARALLEL_MIN_CELLS ? get_pool(w) : NULL,
+	    compare_rows, &j, (w->height + j.rows - 1) / j.rows);
+}
+
+/* rows that moved up or down as a block since the previous frame, as
+ * output that scrolls does, found by their hashes: the longest run of
+ * rows of the new frame that were the same rows of the old one a fixed
+ * distance away, within the rows that changed */
+static void find_scroll(struct watch_ctx *w, unsigned long long blank)
+{
+	const unsigned long long *cur = w->row_hash, *old = w->prev_hash;
+	int top = w->opt.show_title, bottom = w->height;
+	int best = 0, best_by = 0, by, n, y;
+
+	w->scroll_by = 0;
+	while (top < bottom && cur[top] == old[top])
+		top++;
+	while (bottom > top && cur[bottom - 1] == old[bottom - 1])
+		bottom--;
+	for (by = 1; by < bottom - top - best; by++) {
+		for (n = 0; top + by + n < bottom && cur[top + n] == old[top + by + n]; n++)
+			;
+		if (n > best) {
+			best = n;
+			best_by = by;
+		}
+		for (n = 0; top + by + n < bottom && cur[top + by + n] == old[top + n]; n++)
+			;
+		if (n > best) {
+			best = n;
+			best_by = -by;
+		}
+	}
+	if (best < SCROLL_MIN_ROWS)
+		return;
+	/* blank rows match anywhere; moving only those gains nothing */
+	for (y = 0; y < best; y++)
+		if (cur[top + (best_by < 0 ? -best_by : 0) + y] != blank)
+			break;
+	if (y == best)
+		return;
+	w->scroll_top = top;
+	w->scroll_bottom = top + (best_by < 0 ? -best_by : best_by) + best - 1;
+	w->scroll_by = best_by;
+}
+
+/* --tail: the ring has where each line after a newline starts, so the
+ * last screenful can be found without looking back through the output */
+static void tail_push(struct watch_ctx *w, size_t offset)
+{
+	if (w->tail_ring_len < w->tail_ring_size)
+		w->tail_ring[(w->tail_head + w->tail_ring_len++) % w->tail_ring_size] = offset;
+	else {
+		w->tail_ring[w->tail_head] = offset;
+		w->tail_head = (w->tail_head + 1) % w->tail_ring_size;
+	}
+}
+
+static size_t tail_line(const struct watch_ctx *w, int i)
+{
+	return w->tail_ring[(w->tail_head + i) % w->tail_ring_size];
+}
+
+/* where the last lines that can fit on the screen start */
+static size_t tail_start(const struct watch_ctx *w)
+{
+	int rows = w->tail_ring_size - 1, n = w->tail_ring_len;
+
+	if (n && tail_line(w, n - 1) == w->capture_len)
+		n--;	/* the output ends with a newline */
+	/* with fewer, none have been dropped and the first line counts */
+	return n >= rows ? tail_line(w, n - rows) : 0;
+}
+
+/* forget the first n bytes of the capture */
+static void tail_drop(struct watch_ctx *w, size_t n)
+{
+	int i;
+
+	memmove(w->capture, w->capture + n, w->capture_len - n);
+	w->capture_len -= n;
+	if (n)
+		w->capture_cut = -1;
+	while (w->tail_ring_len && tail_line(w, 0) <= n) {
+		w->tail_head = (w->tail_head + 1) % w->tail_ring_size;
+		w->tail_ring_len--;
+	}
+	for (i = 0; i < w->tail_ring_len; i++)
+		w->tail_ring[(w->tail_head + i) % w->tail_ring_size] -= n;
+}
+
+/* build the frame for the current capture and hand it to the sink */
+static void render(struct watch_ctx *w, int redraw_all)
+{
+	struct watch_cell *t = w->prev;
+	unsigned long long *h = w->prev_hash;
+	int hashed = w->rows_hashed;
+	unsigned long long blank;
+
+	w->prev = w->cells;
+	w->cells = t;
+	w->prev_hash = w->row_hash;
+	w->row_hash = h;
+	clear_rows(w, 0, w->height);
+	blank = hash_bytes((const char *) w->cells, w->width * sizeof *w->cells);
+	if (w->opt.show_title)
+		draw_header(w);
+	if (w->opt.tail) {
+		/* long lines wrap: show fewer of them until the last fits */
+		const char *from = w->capture + tail_start(w), *nl;
+
+		while (layout(w, from)
+		    && (nl = memchr(from, '\n', w->capture + w->capture_len - from)) != NULL) {
+			clear_rows(w, w->opt.show_title, w->height);
+			from = nl + 1;
+		}
+	} else
+		layout(w, w->capture);
+	compare(w, redraw_all);
+	w->rows_hashed = 1;
+	w->scroll_by = 0;
+	if (hashed && !redraw_all)
+		find_scroll(w, blank);
+	w->first_screen = 0;
+	if (w->sink.draw)
+		w->sink.draw(w, w->sink.arg);
+}
+
+/*
+ * Running the command
+ */
+
+static int fail(struct watch_ctx *w, const char *func, int code)
+{
+	w->errfunc = func;
+	w->errcode = code;
+	return -1;
+}
+
+static void start_run(struct watch_ctx *w)
+{
+	w->run_start = watch_now(w);
+	if (w->opt.precise && !w->next_run)
+		w->next_run = w->run_start;
+	w->capture_len = 0;
+	w->capture_lines = 0;
+	w->capture_cut = 0;
+	w->tail_ring_len = w->tail_head = 0;
+}
+
+void watch_begin(struct watch_ctx *w)
+{
+	start_run(w);
+	w->state = WATCH_FEEDING;
+}
+
+/* the most output a screenful can show */
+static size_t screen_bytes(const struct watch_ctx *w)
+{
+	return (size_t) (w->height - w->opt.show_title) * w->width * BYTES_PER_CELL;
+}
+
+/* enough output to fill the screen: every line takes at least a row;
+ * for --tail the end is still to come */
+static int screen_full(const struct watch_ctx *w)
+{
+	return !w->opt.tail && (w->capture_lines >= w->height - w->opt.show_title
+	    || w->capture_len >= screen_bytes(w));
+}
+
+static int capture_reserve(struct watch_ctx *w, size_t more)
+{
+	size_t size = w->capture_size ? w->capture_size : 4096;
+	char *p;
+
+	while (size < w->capture_len + more)
+		size *= 2;
+	if (size == w->capture_size)
+		return 0;
+	if ((p = realloc(w->capture, size)) == NULL)
+		return -1;
+	w->capture = p;
+	w->capture_size = size;
+	return 0;
+}
+
+/* room for more output; for --tail, made by dropping output that can no
+ * longer show when that frees at least half of it, so the capture stays
+ * within a few screenfuls however much the command writes */
+static int capture_room(struct watch_ctx *w, size_t more)
+{
+	if (w->opt.tail && w->capture_size - w->capture_len < more) {
+		size_t drop = w->tail_ring_len == w->tail_ring_size ? tail_line(w, 0) : 0;
+
+		if (w->capture_len > screen_bytes(w)
+		    && w->capture_len - screen_bytes(w) > drop)
+			drop = w->capture_len - screen_bytes(w);
+		if (drop && drop >= w->capture_len / 2)
+			tail_drop(w, drop);
+	}
+	return capture_reserve(w, more);
+}
+
+/* count the lines in the len bytes of output just added at offset */
+static void count_lines(struct watch_ctx *w, size_t offset, size_t len)
+{
+	const char *buf = w->capture + offset, *end = buf + len;
+	while ((buf = memchr(buf, '\n', end - buf)) != NULL) {
+		w->capture_lines++;
+		buf++;
+		if (w->opt.tail)
+			tail_push(w, buf - w->capture);
+	}
+}
+
+int watch_feed(struct watch_ctx *w, const char *buf, size_t len)
+{
+	if (screen_full(w))
+		return 1;
+	if (capture_room(w, len) < 0)
+		return fail(w, "malloc", 1);
+	memcpy(w->capture + w->capture_len, buf, len);
+	count_lines(w, w->capture_len, len);
+	w->capture_len += len;
+	return w->capture_cut = screen_full(w);	/* the caller stops there */
+}
+
+/* the interval in effect: the slow one while unfocused, and with
+ * power_save doubled for every IDLE_STRETCH_AFTER the output has not
+ * changed */
+static watch_usec_t current_interval(const struct watch_ctx *w)
+{
+	watch_usec_t interval = USECS_PER_SEC*w->opt.interval;
+
+	if (w->unfocused && w->opt.unfocused_interval > 0)
+		interval = USECS_PER_SEC*w->opt.unfocused_interval;
+	if (w->opt.power_save && w->hist.unchanged_since
+	    && w->run_end > w->hist.unchanged_since) {
+		watch_usec_t idle = (w->run_end - w->hist.unchanged_since) / IDLE_STRETCH_AFTER;
+		interval <<= idle < IDLE_STRETCH_MAX ? idle : IDLE_STRETCH_MAX;
+	}
+	return interval;
+}
+
+/* with power_save, runs start on boundaries of the wall clock that every
+ * watch on the host shares, so their wakeups coalesce: the coarsest of
+ * these no longer than a quarter of the interval */
+static watch_usec_t due_time(const struct watch_ctx *w)
+{
+	static const watch_usec_t grains[] = {
+		60 * USECS_PER_SEC, 30 * USECS_PER_SEC, 10 * USECS_PER_SEC,
+		5 * USECS_PER_SEC, 2 * USECS_PER_SEC, USECS_PER_SEC,
+		USECS_PER_SEC / 2, USECS_PER_SEC / 4, USECS_PER_SEC / 10
+	};
+	watch_usec_t quarter = current_interval(w) / 4;
+	size_t i;
+
+	if (!w->opt.power_save || !w->next_run)
+		return w->next_run;
+	for (i = 0; i < sizeof grains / sizeof grains[0]; i++)
+		if (grains[i] <= quarter)
+			return (w->next_run + grains[i] - 1) / grains[i] * grains[i];
+	return w->next_run;
+}
+
+struct hash_job {
+	const char *p;
+	size_t len, chunk;
+	unsigned long long h[HASH_CHUNKS];
+};
+
+static void hash_chunk(void *arg, int i)
+{
+	struct hash_job *j = arg;
+	size_t off = i * j->chunk;
+
+	j->h[i] = hash_bytes(j->p + off,
+	    j->len - off < j->chunk ? j->len - off : j->chunk);
+}
+
+/* the hash of each chunk, hashed again; big outputs on the pool */
+static unsigned long long hash_capture(struct watch_ctx *w)
+{
+	struct hash_job j;
+	int n;
+
+	j.p = w->capture;
+	j.len = w->capture_len;
+	for (j.chunk = HASH_CHUNK; j.len > j.chunk * HASH_CHUNKS; j.chunk *= 2)
+		;
+	n = (j.len + j.chunk - 1) / j.chunk;
+	pool_run(j.len >= PARALLEL_MIN_BYTES ? get_pool(w) : NULL,
+	    hash_chunk, &j, n);
+	return hash_bytes((const char *) j.h, n * sizeof *j.h);
+}
+
+/* no runs at all while unfocused with unfocused_interval 0 */
+static int held(const struct watch_ctx *w)
+{
+	return w->paused || (w->unfocused && w->opt.unfocused_interval == 0);
+}
+
+/* count the lines of the output that are not in the baseline, and the
+ * lines of the baseline that are not in the output; only as much of both
+ * as was captured, the screenful at the start (or with --tail the end),
+ * and of that only the whole lines */
+static void drift(struct watch_ctx *w)
+{
+	const unsigned long long *base = w->baseline;
+	size_t len = w->capture_len, n, m = w->baseline_lines, i = 0, j = 0;
+
+	w->drift_added = w->drift_removed = 0;
+	if (w->capture_cut > 0) {	/* the last line may be cut short */
+		const char *nl = memrchr(w->capture, '\n', len);
+		len = nl ? (size_t) (nl + 1 - w->capture) : 0;
+	}
+	n = count_lines_in(w->capture, len);
+	if (n > w->line_hashes_size) {
+		unsigned long long *h = realloc(w->line_hashes, n * sizeof *h);
+		if (h == NULL)
+			return;	/* no counts this time */
+		w->line_hashes = h;
+		w->line_hashes_size = n;
+	}
+	hash_lines(w->capture, len, w->line_hashes);
+	qsort(w->line_hashes, n, sizeof *w->line_hashes, compare_hashes);
+	if (w->capture_cut && n < m) {
+		/* the part of the baseline the output can be held up to */
+		memcpy(w->baseline_part, w->baseline_order
+		    + (w->capture_cut > 0 ? 0 : m - n), n * sizeof *base);
+		qsort(w->baseline_part, n, sizeof *base, compare_hashes);
+		base = w->baseline_part;
+		m = n;
+	}
+	while (i < n || j < m) {
+		if (j == m || (i < n && w->line_hashes[i] < base[j])) {
+			w->drift_added++;
+			i++;
+		} else if (i == n || w->line_hashes[i] > base[j]) {
+			w->drift_removed++;
+			j++;
+		} else {
+			i++;
+			j++;
+		}
+	}
+}
+
+void watch_end(struct watch_ctx *w, int status)
+{
+	unsigned long long hash;
+	struct watch_run *r = NULL;
+
+	if (w->opt.tail)	/* the output is what shows */
+		tail_drop(w, tail_start(w));
+	hash = hash_capture(w);
+
+	w->status = status;
+	w->run_end = watch_now(w);
+	if (hash != w->hist.hash || !w->hist.unchanged_since)
+		w->hist.unchanged_since = w->run_end;
+	w->hist.hash = hash;
+	if (!w->hist.runs++)
+		w->hist.duration_avg = w->run_end - w->run_start;
+	else	/* weight 1/8, like TCP's smoothed RTT */
+		w->hist.duration_avg += ((long long) (w->run_end - w->run_start)
+		    - (long long) w->hist.duration_avg) / 8;
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		w->hist.failures++;
+	else
+		w->hist.failures = 0;
+	if (w->opt.precise)
+		w->next_run += current_interval(w);
+	else
+		w->next_run = w->run_end + current_interval(w);
+	w->state = WATCH_IDLE;
+	if (w->baseline)
+		drift(w);
+	if (w->runs) {	/* taking the place of the oldest once full */
+		r = &w->runs[(w->runs_head + w->runs_len) % WATCH_TIMELINE_RUNS];
+		if (w->runs_len < WATCH_TIMELINE_RUNS)
+			w->runs_len++;
+		else
+			w->runs_head = (w->runs_head + 1) % WATCH_TIMELINE_RUNS;
+		r->start = w->run_start;
+		r->duration = w->run_end - w->run_start;
+		r->status = status;
+		r->bytes = w->capture_len;
+	}
+	render(w, w->first_screen);
+	if (r)
+		r->changed = w->changed;
+}
+
+/* --guard: the probe is in, with hash 0 when it could not be taken (so
+ * the next one differs); the command is due a run when the probe changed
+ * or could not be taken, when the last run is older than
+ * opt.guard_max_age, and when it was asked for */
+static void probe_done(struct watch_ctx *w, unsigned long long hash)
+{
+	int changed = !hash || hash != w->guard_hash
+	    || !w->hist.runs || w->run_now
+	    || (w->opt.guard_max_age > 0 && watch_now(w) - w->run_start
+		>= (watch_usec_t) (w->opt.guard_max_age * USECS_PER_SEC));
+
+	w->guard_hash = hash;
+	w->guard_probed = changed;
+	if (changed)
+		w->guard_misses++;
+	else
+		w->guard_hits++;
+	w->state = WATCH_IDLE;
+}
+
+/* carry on with the probe; returns 0 while it is not done */
+static int probe(struct watch_ctx *w)
+{
+	unsigned long long hash;
+
+	if (!guard_poll(w, &hash)) {
+		/* the command closed its output but has not exited */
+		if (w->guard_fd < 0 && w->reap_delay < REAP_DELAY_MAX)
+			w->reap_delay *= 2;
+		return 0;
+	}
+	probe_done(w, hash);
+	return 1;
+}
+
+/* a run left out: the frame stays, apart from the header's counts, and
+ * the next probe is due when the next run would have been */
+static void skip_run(struct watch_ctx *w)
+{
+	if (w->opt.precise)
+		w->next_run += current_interval(w);
+	else
+		w->next_run = watch_now(w) + current_interval(w);
+	render(w, 0);
+}
+
+int watch_spawn(struct watch_ctx *w)
+{
+	int pipefd[2];
+	int status;
+
+	/* a run not left to watch_step() goes without a probe, and the one
+	 * after it with a fresh one */
+	if (guarded(w) && !w->guard_probed)
+		w->guard_hash = 0;
+	w->guard_probed = 0;
+	w->run_now = 0;
+	w->budget_granted = 0;
+
+	/* allocate pipes */
+	if (pipe(pipefd)<0)
+		return fail(w, "pipe", 7);
+
+	/* flush stdout and stderr, since we're about to do fd stuff */
+	fflush(stdout);
+	fflush(stderr);
+
+	/* fork to prepare to run command */
+	w->child=fork();
+
+	if (w->child<0) { /* fork error */
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return fail(w, "fork", 2);
+	} else if (w->child==0) { /* in child */
+		close (pipefd[0]); /* child doesn't need read side of pipe */
+		close (1); /* prepare to replace stdout with pipe */
+		if (dup2 (pipefd[1], 1)<0) { /* replace stdout with write side of pipe */
+			perror("dup2");
+			exit(3);
+		}
+		dup2(1, 2); /* stderr should default to stdout */
+		if (w->opt.sched.set) {
+			const char *func;
+			if (watch_sched_apply(&w->opt.sched, &func) < 0)
+				perror(func); /* shown, but the command still runs */
+		}
+#ifdef PR_SET_TIMERSLACK
+		if (w->opt.power_save) /* the command keeps its own timing */
+			prctl(PR_SET_TIMERSLACK, 0ul);
+#endif
+
+		if (w->opt.each_count) /* one run per target, in sections */
+			exit(each_run(w, screen_bytes(w)));
+		if (w->opt.exec) { /* pass command to exec instead of system */
+			if (execvp(w->opt.argv[0], w->opt.argv)==-1) {
+				perror("exec");
+				exit(4);
+			}
+		} else {
+			status=system(w->opt.command); /* watch manpage promises sh quoting */
+
+			/* propagate command exit status as child exit status */
+			if (!WIFEXITED(status)) { /* child exits nonzero if command does */
+				exit(1);
+			} else {
+				exit(WEXITSTATUS(status));
+			}
+		}
+	}
+
+	/* otherwise, we're in parent */
+	close(pipefd[1]); /* close write side of pipe */
+	if (fcntl(pipefd[0], F_SETFL, O_NONBLOCK) < 0) {
+		close(pipefd[0]);
+		return fail(w, "fcntl", 5);
+	}
+	w->fd = pipefd[0];
+	start_run(w);
+	w->reap_delay = 1000;
+	w->state = WATCH_READING;
+	return 0;
+}
+
+/* count n bytes read into the capture buffer, or end of file for 0;
+ * moves on to WATCH_REAPING at end of file or once there is enough to
+ * fill the screen, closing the pipe early as watch always has (a chatty
+ * child gets SIGPIPE) */
+static void ingested(struct watch_ctx *w, size_t n)
+{
+	if (n > 0) {
+		count_lines(w, w->capture_len, n);
+		w->capture_len += n;
+		if (!screen_full(w))
+			return;
+		w->capture_cut = 1;
+	}
+	close(w->fd);
+	w->fd = -1;
+	w->state = WATCH_REAPING;
+}
+
+/* read what the child has written so far */
+static int ingest(struct watch_ctx *w)
+{
+	while (w->state == WATCH_READING) {
+		ssize_t n;
+
+		if (capture_room(w, 4096) < 0)
+			return fail(w, "malloc", 1);
+		n = read(w->fd, w->capture + w->capture_len,
+		    w->capture_size - w->capture_len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return fail(w, "read", 5);
+		}
+		ingested(w, n);
+	}
+	return 0;
+}
+
+/* harvest child process and get status, propagated from command */
+static int reap(struct watch_ctx *w)
+{
+	int status;
+	pid_t pid = waitpid(w->child, &status, WNOHANG);
+
+	if (pid < 0) {
+		if (errno == EINTR)
+			return 0;
+		return fail(w, "waitpid", 8);
+	}
+	if (pid == 0) {
+		/* still running after closing its output; poll, backing off */
+		if (w->reap_delay < REAP_DELAY_MAX)
+			w->reap_delay *= 2;
+		return 0;
+	}
+	w->child = 0;
+	watch_end(w, status);
+	return 1;
+}
+
+int watch_fd(const struct watch_ctx *w)
+{
+	if (w->state == WATCH_PROBING)
+		return w->guard_fd;
+	return w->state == WATCH_READING ? w->fd : -1;
+}
+
+long long watch_timeout(const struct watch_ctx *w)
+{
+	watch_usec_t now;
+
+	switch (w->state) {
+	case WATCH_IDLE:
+		if (held(w))
+			return -1;
+		now = watch_now(w);
+		return due_time(w) > now ? (long long) (due_time(w) - now) : 0;
+	case WATCH_PROBING:
+		return w->guard_fd >= 0 ? -1 : (long long) w->reap_delay;
+	case WATCH_REAPING:
+		return w->reap_delay;
+	default:
+		return -1;
+	}
+}
+
+int watch_step(struct watch_ctx *w)
+{
+	int events = 0, r;
+
+	switch (w->state) {
+	case WATCH_IDLE:
+		if (held(w) || due_time(w) > watch_now(w))
+			return 0;
+		/* a run the probe let through keeps its word while it
+		 * waits for a token */
+		if (guarded(w) && !w->guard_probed && !w->budget_granted) {
+			w->reap_delay = 1000;
+			w->state = WATCH_PROBING;
+			if (guard_start(w) < 0)
+				probe_done(w, 0);
+		}
+		/* fall through */
+	case WATCH_PROBING:
+		if (w->state == WATCH_PROBING && !probe(w))
+			return 0;
+		if (guarded(w) && !w->guard_probed && !w->budget_granted) {
+			skip_run(w);
+			return 0;
+		}
+		if (w->budget && !w->budget_granted) {
+			/* the token is ours: wait for its slot */
+			watch_usec_t wait = budget_take(w->budget);
+
+			w->budget_granted = 1;
+			if (wait) {
+				w->next_run = watch_now(w) + wait;
+				return 0;
+			}
+		}
+		if (watch_spawn(w) < 0)
+			return -1;
+		events |= WATCH_STARTED;
+		/* fall through - it may have written something already */
+	case WATCH_READING:
+		if (ingest(w) < 0)
+			return -1;
+		if (w->state != WATCH_REAPING)
+			return events;
+		/* fall through */
+	case WATCH_REAPING:
+		if ((r = reap(w)) < 0)
+			return -1;
+		if (r)
+			events |= WATCH_FRAME;
+		return events;
+	case WATCH_FEEDING:
+		break;
+	}
+	return events;
+}
+
+char *watch_read_buffer(struct watch_ctx *w, size_t *len)
+{
+	if (capture_room(w, 4096) < 0) {
+		fail(w, "malloc", 1);
+		return NULL;
+	}
+	*len = w->capture_size - w->capture_len;
+	return w->capture + w->capture_len;
+}
+
+int watch_read_done(struct watch_ctx *w, ssize_t n)
+{
+	int r;
+
+	if (n < 0) {
+		errno = -n;
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		return fail(w, "read", 5);
+	}
+	ingested(w, n);
+	if (w->state != WATCH_REAPING)
+		return 0;
+	if ((r = reap(w)) < 0)
+		return -1;
+	return r ? WATCH_FRAME : 0;
+}
+
+int watch_resize(struct watch_ctx *w, int height, int width)
+{
+	if (alloc_screen(w, height, width) < 0)
+		return fail(w, "malloc", 1);
+	if (w->opt.tail) {	/* the ring is sized by the screen */
+		w->capture_lines = 0;
+		count_lines(w, 0, w->capture_len);
+	}
+	render(w, 1);
+	return 0;
+}
+
+/* move a pending run as if it had been scheduled with the interval now
+ * in effect instead of old */
+static void reschedule(struct watch_ctx *w, watch_usec_t old)
+{
+	if (w->state == WATCH_IDLE && w->next_run) {
+		w->next_run -= old;
+		w->next_run += current_interval(w);
+	}
+}
+
+void watch_set_interval(struct watch_ctx *w, double interval)
+{
+	watch_usec_t old = current_interval(w);
+
+	w->opt.interval = interval;
+	reschedule(w, old);
+}
+
+void watch_pause(struct watch_ctx *w, int paused)
+{
+	w->paused = paused;
+}
+
+/* also resumes a paused context */
+void watch_run_now(struct watch_ctx *w)
+{
+	if (w->state == WATCH_IDLE)
+		w->next_run = watch_now(w);
+	w->run_now = 1;	/* whatever a guard says */
+	w->paused = 0;
+}
+
+int watch_set_command(struct watch_ctx *w, const char *command)
+{
+	if (set_wcommand(w, command) < 0)
+		return fail(w, "mbstowcs", 1);
+	w->opt.command = command;
+	w->opt.exec = 0;
+	return 0;
+}
+
+void watch_set_differences(struct watch_ctx *w, int differences, int cumulative)
+{
+	w->opt.differences = differences;
+	w->opt.cumulative = differences && cumulative;
+}
+
+int watch_set_baseline(struct watch_ctx *w, const char *text, size_t len)
+{
+	unsigned long long *h = NULL;
+	size_t n = 0, size = 0;
+
+	if (text) {
+		/* sorted, in order and room to sort part of it: one more
+		 * each, so that an empty baseline is not NULL */
+		size = count_lines_in(text, len) + 1;
+		if ((h = malloc(3 * size * sizeof *h)) == NULL)
+			return fail(w, "malloc", 1);
+		n = hash_lines(text, len, h + size);
+		memcpy(h, h + size, n * sizeof *h);
+		qsort(h, n, sizeof *h, compare_hashes);
+	}
+	free(w->baseline);
+	w->baseline = h;
+	w->baseline_order = h ? h + size : NULL;
+	w->baseline_part = h ? h + 2 * size : NULL;
+	w->baseline_lines = n;
+	if (w->capture && w->state == WATCH_IDLE) {
+		if (h)
+			drift(w);
+		render(w, 1);
+	}
+	return 0;
+}
+
+int watch_set_budget(struct watch_ctx *w, const char *class, double rate,
+    int burst)
+{
+	const char *func;
+
+	budget_close(w->budget);
+	if ((w->budget = budget_open(class, rate, burst, &func)) == NULL)
+		return fail(w, func, 1);
+	return 0;
+}
+
+int watch_budget_stats(const char *class, FILE *fp, const char **func)
+{
+	return budget_stats(class, fp, func);
+}
+
+void watch_restore(struct watch_ctx *w, const struct watch_history *hist,
+    const struct watch_cell *cells, int height, int width)
+{
+	w->hist = *hist;
+	if (!cells || height != w->height || width != w->width)
+		return;
+	memcpy(w->cells, cells, (size_t) height * width * sizeof *cells);
+	memset(w->dirty, 1, height);
+	w->rows_hashed = 0;
+	w->scroll_by = 0;
+	w->first_screen = 0;
+	if (w->sink.draw)
+		w->sink.draw(w, w->sink.arg);
+}
+
+static int dump(const struct watch_ctx *w, FILE *fp, int ansi)
+{
+	char mb[MB_LEN_MAX];
+	int x, y;
+
+	for (y = 0; y < w->height; y++) {
+		const struct watch_cell *row = watch_row(w, y);
+		unsigned char attr = 0, color = 0;
+		int end = w->width;
+
+		while (end > 0 && row[end - 1].ch == L' ' && !row[end - 1].comb
+		    && (!ansi || (!row[end - 1].attr && !row[end - 1].color)))
+			end--;
+		for (x = 0; x < end; x++) {
+			int n;
+			if (row[x].ch == WATCH_WIDE_CONT)
+				continue;
+			if (ansi && (row[x].attr != attr || row[x].color != color)) {
+				attr = row[x].attr;
+				color = row[x].color;
+				fputs("\033[0", fp);
+				if (attr & WATCH_BOLD)
+					fputs(";1", fp);
+				if (attr & WATCH_STANDOUT)
+					fputs(";7", fp);
+				if (color)
+					fprintf(fp, ";%d", 29 + color);
+				putc('m', fp);
+			}
+			if ((n = wctomb(mb, row[x].ch)) > 0)
+				fwrite(mb, 1, n, fp);
+			if (row[x].comb && (n = wctomb(mb, row[x].comb)) > 0)
+				fwrite(mb, 1, n, fp);
+		}
+		if (attr || color)
+			fputs("\033[m", fp);
+		putc('\n', fp);
+	}
+	return ferror(fp) ? -1 : 0;
+}
+
+int watch_dump(const struct watch_ctx *w, FILE *fp)
+{
+	return dump(w, fp, 0);
+}
+
+int watch_dump_ansi(const struct watch_ctx *w, FILE *fp)
+{
+	return dump(w, fp, 1);
+}
+
+void watch_set_focus(struct watch_ctx *w, int focused)
+{
+	watch_usec_t old = current_interval(w);
+
+	if (w->opt.unfocused_interval < 0 || w->unfocused == !focused)
+		return;
+	w->unfocused = !focused;
+	if (!focused) {
+		reschedule(w, old);
+		return;
+	}
+	/* catch up on what was missed while out of sight */
+	if (w->state == WATCH_IDLE) {
+		watch_usec_t now = watch_now(w);
+		if (w->next_run > now)
+			w->next_run = now;
+	}
+}
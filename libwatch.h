@@ -0,0 +1,329 @@
+/* libwatch -- the spawn, ingest, diff and render pipeline of watch
+ *
+ * A watch_ctx runs a command on a schedule, captures its output, lays it
+ * out into a grid of cells the size of the screen (header included),
+ * marks the cells that changed since the previous run, and hands the
+ * finished frame to an output sink.  Nothing blocks: the caller polls
+ * watch_fd() for input and sleeps at most watch_timeout() before calling
+ * watch_step(), so a context can live in any event loop.  The watch
+ * program itself is one such caller, drawing with curses.
+ *
+ * The structures are visible so that sinks and callers can read them,
+ * but only libwatch writes to them.
+ */
+
+#ifndef LIBWATCH_H
+#define LIBWATCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <wchar.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned long long watch_usec_t;
+#define USECS_PER_SEC (1000000ull)
+
+/* cell attributes */
+#define WATCH_BOLD	0x01
+#define WATCH_STANDOUT	0x02	/* highlighted by --differences */
+
+/* ch of the cell covered by the right half of a double-width character */
+#define WATCH_WIDE_CONT	((wchar_t) -1)
+
+struct watch_cell {
+	wchar_t ch;
+	wchar_t comb;		/* one combining character, or 0 */
+	unsigned char attr;	/* WATCH_BOLD | WATCH_STANDOUT */
+	unsigned char color;	/* 0 for default, else 1 + ANSI color 0..7 */
+};
+
+/* how a process competes for the machine; each setting applies only if
+ * its bit is in set */
+#define WATCH_SCHED_NICE	0x01
+#define WATCH_SCHED_IONICE	0x02
+#define WATCH_SCHED_POLICY	0x04
+#define WATCH_SCHED_CPUS	0x08
+#define WATCH_SCHED_MAX_CPUS	1024
+#define WATCH_SCHED_CPU_BITS	(8 * sizeof(unsigned long))
+
+struct watch_sched {
+	int set;
+	int nice;		/* -20 to 19 */
+	int ioclass, iolevel;	/* 1 realtime, 2 best-effort, 3 idle; 0 to 7 */
+	int policy;		/* 0 other, 1 batch, 2 idle */
+	unsigned long cpus[WATCH_SCHED_MAX_CPUS / WATCH_SCHED_CPU_BITS];
+};
+
+/* what to run and how; copied by watch_new() except for the strings */
+struct watch_options {
+	const char *command;	/* shell command, shown in the header */
+	char **argv;		/* run with execvp() instead when exec is set */
+	int exec;
+	double interval;	/* seconds */
+	int precise;		/* schedule from run starts, not run ends */
+	int differences;	/* highlight changes between frames */
+	int cumulative;		/* ... and keep them highlighted */
+	int color;		/* interpret ANSI color sequences */
+	int show_title;		/* rows used by the header, 2 or 0 */
+	double unfocused_interval;	/* seconds between runs while not
+					 * focused, 0 to pause, < 0 to ignore
+					 * focus */
+	int power_save;		/* coalesce wakeups, stretch when idle */
+	int threads;		/* for very large frames: 0 for one per CPU,
+				 * 1 to stay on the calling thread */
+	struct watch_sched sched;	/* applied to the command */
+	char **each;		/* run the command once per target, with {}
+				 * replaced by it, each output in a section of
+				 * its own; the array is not copied either */
+	int each_count;
+	int jobs;		/* targets run at once, 0 for the default */
+	int tail;		/* show the last screenful of output rather
+				 * than the first, keeping only that much */
+	int timeline;		/* the header's second row shows the last
+				 * runs, how long they took and how they
+				 * exited */
+	const char *guard;	/* a cheap command whose output must change */
+	char **guard_paths;	/* ... or files that must, for a run to be
+				 * made; the array is not copied */
+	int guard_path_count;
+	double guard_max_age;	/* seconds after which a run is made
+				 * anyway, 0 for never */
+};
+
+struct watch_ctx;
+struct watch_pool;
+struct watch_budget;
+
+/* one run, for the timeline */
+struct watch_run {
+	watch_usec_t start, duration;
+	int status;		/* wait status */
+	size_t bytes;		/* of output captured */
+	int changed;		/* cells highlighted in its frame */
+};
+
+#define WATCH_TIMELINE_RUNS 512	/* runs kept, more than a row shows */
+
+/* what the runs so far have shown, kept across restarts by watch_restore() */
+struct watch_history {
+	unsigned long long hash;	/* of the last complete output */
+	watch_usec_t unchanged_since;	/* when that output last changed */
+	watch_usec_t duration_avg;	/* moving average of run durations */
+	unsigned failures;	/* consecutive runs that exited non-zero */
+	unsigned long long runs;
+};
+
+/* receives finished frames; draw is called once per frame, and after a
+ * resize, and may skip rows whose dirty flag is clear */
+struct watch_sink {
+	void (*draw)(struct watch_ctx *w, void *arg);
+	void *arg;
+};
+
+/* a time source; the default reads the wall clock */
+struct watch_clock {
+	watch_usec_t (*now)(void *arg);
+	void *arg;
+};
+
+enum watch_state {
+	WATCH_IDLE,		/* waiting for the next run to be due */
+	WATCH_PROBING,		/* due, taking the --guard probe first */
+	WATCH_READING,		/* child running, reading its output */
+	WATCH_REAPING,		/* output done, waiting for the child to exit */
+	WATCH_FEEDING		/* run fed by watch_feed() instead of a child */
+};
+
+/* events returned by watch_step() */
+#define WATCH_STARTED	0x01	/* a run of the command started */
+#define WATCH_FRAME	0x02	/* a run finished and its frame was drawn */
+
+struct watch_ctx {
+	struct watch_options opt;
+	struct watch_sink sink;
+	struct watch_clock clock;
+
+	/* the command as wide characters, for the header */
+	wchar_t *wcommand;
+	int wcommand_columns;
+	int wcommand_characters;
+
+	/* the screen: height rows of width cells, and the previous frame */
+	int height, width;
+	struct watch_cell *cells, *prev;
+	unsigned char *dirty;	/* per row: differs from what was drawn */
+	int first_screen;	/* nothing to compare against yet */
+	int changed;		/* cells highlighted in the last frame */
+
+	/* when scroll_by is not 0, rows scroll_top to scroll_bottom hold
+	 * what the previous frame had scroll_by rows lower (higher when
+	 * negative), apart from the rows that leaves uncovered: a sink that
+	 * scrolls them on the terminal need only draw the uncovered rows
+	 * and the dirty rows outside */
+	int scroll_top, scroll_bottom, scroll_by;
+	unsigned long long *row_hash, *prev_hash;	/* per row */
+	int rows_hashed;	/* row_hash goes with the cells */
+
+	/* the current run */
+	enum watch_state state;
+	int paused;		/* no new runs until resumed */
+	int unfocused;		/* the terminal is not focused or visible */
+	pid_t child;
+	int fd;			/* read side of the child's stdout */
+	int status;		/* wait status of the last run */
+	char *capture;		/* output of the current or last run */
+	size_t capture_len, capture_size;
+	int capture_lines;	/* newlines seen, to stop once the screen is full */
+	int capture_cut;	/* 1 if output after the capture was left out,
+				 * -1 if output before it (--tail) */
+	/* with opt.tail: where in the capture the most recent lines start,
+	 * oldest first from tail_head, one more than there are rows */
+	size_t *tail_ring;
+	int tail_ring_size, tail_ring_len, tail_head;
+	watch_usec_t run_start, run_end;
+	watch_usec_t next_run;	/* when the next run is due */
+	watch_usec_t reap_delay;	/* backoff while waiting for a child */
+	struct watch_history hist;
+	/* with opt.timeline, the last runs: oldest first from runs_head */
+	struct watch_run *runs;
+	int runs_len, runs_head;
+	/* with a guard: the probe taken before the last run, whether one
+	 * was taken for the run about to be made, and the runs left out
+	 * and made because of it */
+	unsigned long long guard_hash;
+	int guard_probed;
+	/* the probe in progress: its command, the read side of its output
+	 * and the hash so far */
+	pid_t guard_child;
+	int guard_fd;
+	unsigned long long guard_sum;
+	int run_now;		/* watch_run_now() was called */
+	struct watch_budget *budget;	/* shared with other watches */
+	int budget_granted;	/* a token is in hand for the next run */
+	unsigned long guard_hits, guard_misses;
+	/* lines of output hashed, to compare against; and how
+	 * many lines of the last output were not in it, and of it were not
+	 * in the last output */
+	unsigned long long *baseline;	/* sorted */
+	unsigned long long *baseline_order;	/* as in the file */
+	unsigned long long *baseline_part;	/* room to sort part of it in */
+	size_t baseline_lines;
+	unsigned long drift_added, drift_removed;
+	unsigned long long *line_hashes;	/* of the last output */
+	size_t line_hashes_size;
+	int *each_rows;		/* lines each target's section has needed,
+				 * shared with the child running them */
+
+	struct watch_pool *pool;	/* worker threads, once needed */
+	int pool_tried;
+
+	/* set when a call fails: the failing function and the exit status
+	 * watch has always used for it */
+	const char *errfunc;
+	int errcode;
+};
+
+/* create a context for a screen of height x width; NULL on failure */
+extern struct watch_ctx *watch_new(const struct watch_options *opt,
+    int height, int width);
+extern void watch_free(struct watch_ctx *w);
+
+extern void watch_set_sink(struct watch_ctx *w, const struct watch_sink *sink);
+extern void watch_set_clock(struct watch_ctx *w, const struct watch_clock *clock);
+
+/* the wall clock, in usec */
+extern watch_usec_t watch_time_usec(void);
+extern watch_usec_t watch_now(const struct watch_ctx *w);
+
+/* event loop integration: the fd to poll for input (or -1), and how long
+ * until watch_step() has something to do (-1: only when the fd is ready) */
+extern int watch_fd(const struct watch_ctx *w);
+extern long long watch_timeout(const struct watch_ctx *w);
+
+/* do whatever is due without blocking; returns WATCH_* events, or -1
+ * with errfunc and errcode set */
+extern int watch_step(struct watch_ctx *w);
+
+/* lower level: start a run by spawning the command, or start one whose
+ * output the caller supplies with watch_feed() and ends with watch_end() */
+extern int watch_spawn(struct watch_ctx *w);
+extern void watch_begin(struct watch_ctx *w);
+extern int watch_feed(struct watch_ctx *w, const char *buf, size_t len);
+extern void watch_end(struct watch_ctx *w, int status);
+
+/* for loops that complete reads themselves (io_uring and the like)
+ * instead of leaving them to watch_step() while in WATCH_READING: where
+ * to read up to *len bytes of the child's output next (NULL on failure),
+ * and how the read went, as a byte count, 0 for end of file or -errno;
+ * watch_read_done() returns WATCH_* events like watch_step() */
+extern char *watch_read_buffer(struct watch_ctx *w, size_t *len);
+extern int watch_read_done(struct watch_ctx *w, ssize_t n);
+
+/* the screen changed size: lay the last output out again and redraw */
+extern int watch_resize(struct watch_ctx *w, int height, int width);
+
+/* change the schedule or the command between runs; the command string
+ * must stay valid for as long as the context uses it */
+extern void watch_set_interval(struct watch_ctx *w, double interval);
+extern void watch_pause(struct watch_ctx *w, int paused);
+extern void watch_run_now(struct watch_ctx *w);
+extern int watch_set_command(struct watch_ctx *w, const char *command);
+extern void watch_set_differences(struct watch_ctx *w, int differences,
+    int cumulative);
+
+/* the terminal gained or lost focus; while unfocused runs happen every
+ * unfocused_interval, and regaining focus runs the command at once */
+extern void watch_set_focus(struct watch_ctx *w, int focused);
+
+/* set one of the WATCH_SCHED_* settings from text as nice(1), ionice(1)
+ * ("idle", "best-effort:7"), chrt(1) ("other", "batch", "idle") and
+ * taskset -c ("0-3,8") take it; -1 if it is not understood */
+extern int watch_sched_parse(struct watch_sched *s, int what, const char *arg);
+
+/* apply the settings to the calling process; -1 with errno set and the
+ * failing call in *func */
+extern int watch_sched_apply(const struct watch_sched *s, const char **func);
+
+/* highlight every line that is not in text, instead of what changed
+ * since the previous frame, and count the lines that differ in the
+ * header; text is copied, NULL goes back to comparing frames */
+extern int watch_set_baseline(struct watch_ctx *w, const char *text, size_t len);
+
+/* carry on from an earlier watch: take over its history and, if the
+ * screen is still the same size, show its last frame and diff the next
+ * one against it */
+extern void watch_restore(struct watch_ctx *w, const struct watch_history *hist,
+    const struct watch_cell *cells, int height, int width);
+
+/* before every run, take a token from the bucket of class that all
+ * watches on the host given it share, first setting it to rate runs a
+ * second in bursts of up to burst unless a running watch already set it;
+ * runs wait their turn when it is empty */
+#define WATCH_BUDGET_RATE_MIN	(1.0 / 86400)	/* a run a day */
+#define WATCH_BUDGET_RATE_MAX	1e6	/* a run a usec */
+#define WATCH_BUDGET_BURST_MAX	1000000
+extern int watch_set_budget(struct watch_ctx *w, const char *class,
+    double rate, int burst);
+/* write what the bucket of class has seen to fp; -1 with *func set on
+ * failure */
+extern int watch_budget_stats(const char *class, FILE *fp, const char **func);
+
+/* write the current frame as text, one line per row */
+extern int watch_dump(const struct watch_ctx *w, FILE *fp);
+/* ... with bold, highlighting and colors as ANSI escape sequences */
+extern int watch_dump_ansi(const struct watch_ctx *w, FILE *fp);
+
+static inline struct watch_cell *watch_row(const struct watch_ctx *w, int y)
+{
+	return w->cells + (size_t) y * w->width;
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,281 @@
+/* linestore.c -- content-addressed storage for lines of output
+ *
+ * Line bytes live in slabs, allocated by bumping a pointer; a line is
+ * never moved except by compaction, which copies the live lines into one
+ * fresh slab and frees the old ones whole.  Ids index an array of line
+ * entries, chained by hash from a power-of-two table of buckets; freed
+ * ids are chained into a free list and reused.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "linestore.h"
+
+#define SLAB_SIZE (64 * 1024)
+
+/* the room a line takes: aligned, so that arrays of ids can be stored,
+ * and never none, so that every line has a pointer of its own */
+#define ROOM(len) ((len) ? ((len) + 7) & ~(size_t) 7 : 8)
+
+struct line {
+	unsigned long long hash;
+	char *p;		/* NULL for a free id */
+	size_t len;
+	unsigned refs;
+	watch_line_id next;	/* in the bucket, or the free list */
+};
+
+/* what a line costs, its entry included: for a short line that is most
+ * of it */
+#define COST(len) (ROOM(len) + sizeof(struct line))
+
+struct slab {
+	struct slab *next;
+	size_t used, size;
+	char data[];
+};
+
+struct watch_lines {
+	struct line *lines;	/* lines[0] is unused */
+	unsigned nlines, lines_size;
+	watch_line_id *buckets;
+	unsigned nbuckets;	/* a power of two */
+	unsigned count;		/* ids in use */
+	watch_line_id free_ids;
+	struct slab *slabs;	/* the one being filled first */
+	size_t bytes, garbage;
+};
+
+struct watch_lines *watch_lines_new(void)
+{
+	struct watch_lines *s = calloc(1, sizeof *s);
+
+	if (s == NULL)
+		return NULL;
+	s->nbuckets = 1024;
+	s->buckets = calloc(s->nbuckets, sizeof *s->buckets);
+	s->nlines = 1;
+	if (s->buckets == NULL) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+static void free_slabs(struct slab *slab)
+{
+	while (slab) {
+		struct slab *next = slab->next;
+		free(slab);
+		slab = next;
+	}
+}
+
+void watch_lines_free(struct watch_lines *s)
+{
+	if (s == NULL)
+		return;
+	free_slabs(s->slabs);
+	free(s->lines);
+	free(s->buckets);
+	free(s);
+}
+
+unsigned long long watch_lines_hash(const char *p, size_t len)
+{
+	return watch_lines_hash_more(14695981039346656037ull, p, len);
+}
+
+unsigned long long watch_lines_hash_more(unsigned long long h,
+    const void *p, size_t len)
+{
+	const unsigned char *c = p;
+
+	while (len--) {
+		h ^= *c++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+/* room for len bytes at the head of the slab list */
+static char *slab_alloc(struct slab **slabs, size_t len)
+{
+	struct slab *slab = *slabs;
+
+	if (!slab || slab->size - slab->used < len) {
+		size_t size = len > SLAB_SIZE ? len : SLAB_SIZE;
+		if ((slab = malloc(sizeof *slab + size)) == NULL)
+			return NULL;
+		slab->used = 0;
+		slab->size = size;
+		if (*slabs && len > SLAB_SIZE) {
+			/* keep filling the current one */
+			slab->next = (*slabs)->next;
+			(*slabs)->next = slab;
+		} else {
+			slab->next = *slabs;
+			*slabs = slab;
+		}
+	}
+	slab->used += len;
+	return slab->data + slab->used - len;
+}
+
+/* chain the lines into buckets, a new and zeroed array of nbuckets */
+static void rechain(struct watch_lines *s, watch_line_id *buckets,
+    unsigned nbuckets)
+{
+	unsigned i;
+
+	free(s->buckets);
+	s->buckets = buckets;
+	s->nbuckets = nbuckets;
+	for (i = 1; i < s->nlines; i++) {
+		struct line *l = &s->lines[i];
+		if (l->p) {
+			l->next = buckets[l->hash & (nbuckets - 1)];
+			buckets[l->hash & (nbuckets - 1)] = i;
+		}
+	}
+}
+
+static void rehash(struct watch_lines *s, unsigned nbuckets)
+{
+	watch_line_id *buckets = calloc(nbuckets, sizeof *buckets);
+
+	if (buckets == NULL)
+		return;	/* longer chains, no harm done */
+	rechain(s, buckets, nbuckets);
+}
+
+watch_line_id watch_lines_intern(struct watch_lines *s,
+    const char *p, size_t len, unsigned long long hash)
+{
+	watch_line_id id, *bucket = &s->buckets[hash & (s->nbuckets - 1)];
+	struct line *l;
+
+	for (id = *bucket; id; id = s->lines[id].next) {
+		l = &s->lines[id];
+		if (l->hash == hash && l->len == len && !memcmp(l->p, p, len)) {
+			if (!l->refs++)
+				s->garbage -= COST(len);
+			return id;
+		}
+	}
+
+	if (s->free_ids)
+		id = s->free_ids;
+	else if (s->nlines < s->lines_size)
+		id = s->nlines;
+	else {
+		unsigned size = s->lines_size ? s->lines_size * 2 : 1024;
+		struct line *lines = realloc(s->lines, size * sizeof *lines);
+		if (lines == NULL)
+			return 0;
+		s->lines = lines;
+		s->lines_size = size;
+		id = s->nlines;
+	}
+	l = &s->lines[id];
+	if ((l->p = slab_alloc(&s->slabs, ROOM(len))) == NULL)
+		return 0;
+	memcpy(l->p, p, len);
+	if (id == s->free_ids)
+		s->free_ids = l->next;
+	else
+		s->nlines++;
+	l->hash = hash;
+	l->len = len;
+	l->refs = 1;
+	l->next = *bucket;
+	*bucket = id;
+	s->bytes += COST(len);
+	if (++s->count > s->nbuckets)
+		rehash(s, s->nbuckets * 2);
+	return id;
+}
+
+void watch_lines_ref(struct watch_lines *s, watch_line_id id)
+{
+	if (!s->lines[id].refs++)
+		s->garbage -= COST(s->lines[id].len);
+}
+
+unsigned watch_lines_unref(struct watch_lines *s, watch_line_id id)
+{
+	if (!--s->lines[id].refs)
+		s->garbage += COST(s->lines[id].len);
+	return s->lines[id].refs;
+}
+
+unsigned watch_lines_refs(const struct watch_lines *s, watch_line_id id)
+{
+	return s->lines[id].refs;
+}
+
+const char *watch_lines_get(const struct watch_lines *s,
+    watch_line_id id, size_t *len)
+{
+	*len = s->lines[id].len;
+	return s->lines[id].p;
+}
+
+size_t watch_lines_garbage(const struct watch_lines *s)
+{
+	return s->garbage;
+}
+
+size_t watch_lines_bytes(const struct watch_lines *s)
+{
+	return s->bytes;
+}
+
+int watch_lines_compact(struct watch_lines *s)
+{
+	struct slab *slab = NULL;
+	size_t live = 0;
+	unsigned i;
+	char *p;
+	/* the old chains run through the ids freed below: everything that
+	 * can fail is done first, so a failure leaves the store as it was */
+	watch_line_id *buckets = calloc(s->nbuckets, sizeof *buckets);
+
+	if (buckets == NULL)
+		return -1;
+	/* all the live lines go into one slab of their own */
+	for (i = 1; i < s->nlines; i++)
+		if (s->lines[i].p && s->lines[i].refs)
+			live += ROOM(s->lines[i].len);
+	if (live) {
+		if ((slab = malloc(sizeof *slab + live)) == NULL) {
+			free(buckets);
+			return -1;
+		}
+		slab->next = NULL;
+		slab->used = slab->size = live;
+	}
+	p = slab ? slab->data : NULL;
+	for (i = 1; i < s->nlines; i++) {
+		struct line *l = &s->lines[i];
+
+		if (!l->p)
+			continue;
+		if (!l->refs) {
+			l->p = NULL;
+			l->next = s->free_ids;
+			s->free_ids = i;
+			s->count--;
+			continue;
+		}
+		memcpy(p, l->p, l->len);
+		l->p = p;
+		p += ROOM(l->len);
+	}
+	free_slabs(s->slabs);
+	s->slabs = slab;
+	s->bytes -= s->garbage;
+	s->garbage = 0;
+	rechain(s, buckets, s->nbuckets);
+	return 0;
+}
@@ -0,0 +1,64 @@
+/* linestore -- content-addressed storage for lines of output
+ *
+ * Anything that keeps many frames of a command's output keeps mostly the
+ * same lines over and over.  A watch_lines store keeps each distinct
+ * line once, under a small integer id, and counts the references to it,
+ * so a frame can be kept as an array of ids.  Lines nobody refers to
+ * any more stay findable (output often flips back) until
+ * watch_lines_compact() drops them and packs the rest together.
+ *
+ * A "line" is any run of bytes; storing arrays of ids as lines works
+ * too, which is how a frame can share whole runs of lines with another.
+ */
+
+#ifndef LINESTORE_H
+#define LINESTORE_H
+
+#include <stddef.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned watch_line_id;		/* 0 is never a line */
+
+struct watch_lines;
+
+extern struct watch_lines *watch_lines_new(void);
+extern void watch_lines_free(struct watch_lines *s);
+
+/* FNV-1a, the hash the store expects; callers that already hash their
+ * lines can pass their own as long as equal lines get equal hashes */
+extern unsigned long long watch_lines_hash(const char *p, size_t len);
+/* carry on a hash of watch_lines_hash() over len more bytes, for input
+ * that arrives in pieces */
+extern unsigned long long watch_lines_hash_more(unsigned long long h,
+    const void *p, size_t len);
+
+/* the id of the line, storing it if need be, with a reference taken;
+ * 0 when out of memory */
+extern watch_line_id watch_lines_intern(struct watch_lines *s,
+    const char *p, size_t len, unsigned long long hash);
+
+extern void watch_lines_ref(struct watch_lines *s, watch_line_id id);
+/* returns the references left */
+extern unsigned watch_lines_unref(struct watch_lines *s, watch_line_id id);
+extern unsigned watch_lines_refs(const struct watch_lines *s, watch_line_id id);
+
+extern const char *watch_lines_get(const struct watch_lines *s,
+    watch_line_id id, size_t *len);
+
+/* bytes held by lines without references, and by all lines, counting
+ * their bookkeeping */
+extern size_t watch_lines_garbage(const struct watch_lines *s);
+extern size_t watch_lines_bytes(const struct watch_lines *s);
+
+/* forget lines without references and pack the others; pointers from
+ * watch_lines_get() are invalid afterwards, ids are not */
+extern int watch_lines_compact(struct watch_lines *s);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,131 @@
+/* pool.c -- a few worker threads for libwatch
+ *
+ * A job is n independent pieces of work.  The caller and every worker
+ * take the next piece not yet taken until there are none left, so a
+ * worker that finishes early goes on to pieces another would have done
+ * and nobody waits on a slow piece but its own thread.
+ */
+
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include "pool.h"
+
+struct watch_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	pthread_t *threads;
+	int nthreads;
+	int quit;
+	unsigned long generation;	/* bumped for every job */
+
+	void (*fn)(void *arg, int i);
+	void *arg;
+	int n;
+	int next;		/* the next piece to take */
+	int busy;		/* workers still on the current job */
+};
+
+static void take(struct watch_pool *p)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->n)
+		p->fn(p->arg, i);
+}
+
+static void *worker(void *arg)
+{
+	struct watch_pool *p = arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (p->generation == seen && !p->quit)
+			pthread_cond_wait(&p->start, &p->lock);
+		if (p->quit)
+			break;
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
+		take(p);
+		pthread_mutex_lock(&p->lock);
+		if (--p->busy == 0)
+			pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+struct watch_pool *pool_new(int threads)
+{
+	struct watch_pool *p = calloc(1, sizeof *p);
+	sigset_t all, old;
+
+	if (!p || !(p->threads = calloc(threads, sizeof *p->threads))) {
+		free(p);
+		return NULL;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	/* signals are for the caller's threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (; p->nthreads < threads; p->nthreads++)
+		if (pthread_create(&p->threads[p->nthreads], NULL, worker, p))
+			break;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!p->nthreads) {
+		pool_free(p);
+		return NULL;
+	}
+	return p;
+}
+
+void pool_free(struct watch_pool *p)
+{
+	int i;
+
+	if (p == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->start);
+	pthread_mutex_destroy(&p->lock);
+	free(p->threads);
+	free(p);
+}
+
+void pool_run(struct watch_pool *p, void (*fn)(void *arg, int i),
+    void *arg, int n)
+{
+	int i;
+
+	if (p == NULL || n < 2) {
+		for (i = 0; i < n; i++)
+			fn(arg, i);
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->arg = arg;
+	p->n = n;
+	p->next = 0;
+	p->busy = p->nthreads;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	take(p);
+
+	pthread_mutex_lock(&p->lock);
+	while (p->busy)
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
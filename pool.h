@@ -0,0 +1,18 @@
+/* pool.h -- libwatch's worker threads, for frames too big for one core;
+ * private to the library */
+
+#ifndef WATCH_POOL_H
+#define WATCH_POOL_H
+
+struct watch_pool;
+
+/* threads workers besides the caller; NULL when they cannot be started */
+extern struct watch_pool *pool_new(int threads);
+extern void pool_free(struct watch_pool *p);
+
+/* call fn(arg, i) for every i in [0, n), spread over the workers and the
+ * caller, and return once all are done; with no pool, just loop */
+extern void pool_run(struct watch_pool *p, void (*fn)(void *arg, int i),
+    void *arg, int n);
+
+#endif
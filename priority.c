@@ -0,0 +1,151 @@
+/* priority.c -- how the command, or watch itself, competes for the
+ * machine: niceness, I/O priority, scheduling policy and CPU affinity
+ *
+ * Everything but niceness is Linux only; elsewhere asking for it fails
+ * with ENOSYS.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+#include "libwatch.h"
+
+/* from linux/ioprio.h, which not every system with the call has */
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_WHO_PROCESS	1
+
+static const char *const ioclasses[] = { "none", "realtime", "best-effort", "idle" };
+static const char *const policies[] = { "other", "batch", "idle" };
+
+static int lookup(const char *const *names, int n, const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (strlen(names[i]) == len && !strncmp(names[i], name, len))
+			return i;
+	return -1;
+}
+
+/* a list like 0-3,8 */
+static int parse_cpus(struct watch_sched *s, const char *arg)
+{
+	memset(s->cpus, 0, sizeof s->cpus);
+	do {
+		char *end;
+		long first = strtol(arg, &end, 10), last = first;
+
+		if (end == arg)
+			return -1;
+		if (*end == '-') {
+			arg = end + 1;
+			last = strtol(arg, &end, 10);
+			if (end == arg)
+				return -1;
+		}
+		if (first < 0 || last < first || last >= WATCH_SCHED_MAX_CPUS)
+			return -1;
+		for (; first <= last; first++)
+			s->cpus[first / WATCH_SCHED_CPU_BITS] |=
+			    1ul << (first % WATCH_SCHED_CPU_BITS);
+		arg = end;
+	} while (*arg++ == ',');
+	return arg[-1] ? -1 : 0;
+}
+
+int watch_sched_parse(struct watch_sched *s, int what, const char *arg)
+{
+	const char *colon;
+	char *end;
+
+	switch (what) {
+	case WATCH_SCHED_NICE:
+		s->nice = strtol(arg, &end, 10);
+		if (!*arg || *end || s->nice < -20 || s->nice > 19)
+			return -1;
+		break;
+	case WATCH_SCHED_IONICE:
+		colon = strchr(arg, ':');
+		s->ioclass = lookup(ioclasses, 4, arg, colon ? (size_t) (colon - arg) : strlen(arg));
+		s->iolevel = 4;		/* the kernel's default */
+		if (s->ioclass <= 0)
+			return -1;
+		if (colon) {
+			s->iolevel = strtol(colon + 1, &end, 10);
+			if (!colon[1] || *end || s->iolevel < 0 || s->iolevel > 7)
+				return -1;
+		}
+		break;
+	case WATCH_SCHED_POLICY:
+		if ((s->policy = lookup(policies, 3, arg, strlen(arg))) < 0)
+			return -1;
+		break;
+	case WATCH_SCHED_CPUS:
+		if (parse_cpus(s, arg) < 0)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+	s->set |= what;
+	return 0;
+}
+
+int watch_sched_apply(const struct watch_sched *s, const char **func)
+{
+	if ((s->set & WATCH_SCHED_NICE)
+	    && setpriority(PRIO_PROCESS, 0, s->nice) < 0) {
+		*func = "setpriority";
+		return -1;
+	}
+#ifdef __linux__
+	if (s->set & WATCH_SCHED_POLICY) {
+		static const int policy[] = { SCHED_OTHER, SCHED_BATCH, SCHED_IDLE };
+		struct sched_param param = { 0 };
+
+		if (sched_setscheduler(0, policy[s->policy], &param) < 0) {
+			*func = "sched_setscheduler";
+			return -1;
+		}
+	}
+	if (s->set & WATCH_SCHED_IONICE) {
+		*func = "ioprio_set";
+#ifdef SYS_ioprio_set
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    s->ioclass << IOPRIO_CLASS_SHIFT | (s->ioclass == 3 ? 0 : s->iolevel)) < 0)
+			return -1;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+	if (s->set & WATCH_SCHED_CPUS) {
+		cpu_set_t set;
+		int cpu;
+
+		CPU_ZERO(&set);
+		for (cpu = 0; cpu < WATCH_SCHED_MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+			if (s->cpus[cpu / WATCH_SCHED_CPU_BITS] & (1ul << (cpu % WATCH_SCHED_CPU_BITS)))
+				CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof set, &set) < 0) {
+			*func = "sched_setaffinity";
+			return -1;
+		}
+	}
+#else
+	if (s->set & ~WATCH_SCHED_NICE) {
+		*func = "watch_sched_apply";
+		errno = ENOSYS;
+		return -1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,324 @@
+/* record.c -- --record and --export
+ *
+ * A recording is a header followed by one entry per frame: when the run
+ * behind it ended, the size of the screen, and only the rows that differ
+ * from the frame before (all of them for the first frame and after a
+ * resize), each as its row number and its cells.  It is written as the
+ * frames are drawn and flushed after each, so even a watch that is
+ * killed leaves a usable recording, and it takes little room for output
+ * that changes a little at a time.  Like the --state file it holds the
+ * cells as they are in memory, so it is read back by the same build.
+ *
+ * Exporting streams through the entries keeping only the screen as it
+ * stands, and turns each frame into what a terminal needs to be sent to
+ * get there from the frame before: the changed part of each changed row,
+ * with attributes only set where they change and erase-to-end-of-line
+ * for blank tails, much as curses draws the live screen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "record.h"
+
+#define RECORD_MAGIC	"watchrc"
+#define RECORD_VERSION	1
+
+struct record_header {
+	char magic[8];		/* RECORD_MAGIC */
+	unsigned version;	/* RECORD_VERSION */
+	unsigned cell_size;	/* sizeof (struct watch_cell) */
+};
+
+struct record_frame {
+	watch_usec_t time;	/* the end of the run */
+	int height, width;
+	int rows;		/* rows that follow, each an int and width cells */
+};
+
+static FILE *record_fp;
+static struct watch_cell *last;	/* the frame recorded last */
+static unsigned char *changed;
+static int last_height, last_width;
+
+int record_open(const char *path)
+{
+	struct record_header h;
+
+	if ((record_fp = fopen(path, "w")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, RECORD_MAGIC, sizeof h.magic);
+	h.version = RECORD_VERSION;
+	h.cell_size = sizeof (struct watch_cell);
+	if (fwrite(&h, sizeof h, 1, record_fp) != 1 || fflush(record_fp) == EOF) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static int blank(const struct watch_cell *c)
+{
+	return c->ch == L' ' && !c->comb && !c->attr && !c->color;
+}
+
+void record_frame(const struct watch_ctx *w)
+{
+	size_t rowbytes = w->width * sizeof *w->cells;
+	struct record_frame f;
+	int y;
+
+	if (record_fp == NULL)
+		return;
+	if (w->height != last_height || w->width != last_width) {
+		struct watch_cell *l = realloc(last, w->height * rowbytes);
+		unsigned char *c = realloc(changed, w->height);
+
+		if (l)
+			last = l;
+		if (c)
+			changed = c;
+		if (!l || !c) {
+			fclose(record_fp);	/* give up, keeping what is there */
+			record_fp = NULL;
+			return;
+		}
+		last_height = -1;	/* every row counts as changed */
+	}
+	f.time = w->run_end;
+	f.height = w->height;
+	f.width = w->width;
+	f.rows = 0;
+	for (y = 0; y < w->height; y++) {
+		changed[y] = last_height < 0
+		    || memcmp(watch_row(w, y), last + (size_t) y * w->width, rowbytes);
+		f.rows += changed[y];
+	}
+	fwrite(&f, sizeof f, 1, record_fp);
+	for (y = 0; y < w->height; y++)
+		if (changed[y]) {
+			fwrite(&y, sizeof y, 1, record_fp);
+			fwrite(watch_row(w, y), rowbytes, 1, record_fp);
+			memcpy(last + (size_t) y * w->width, watch_row(w, y), rowbytes);
+		}
+	last_height = w->height;
+	last_width = w->width;
+	if (fflush(record_fp) == EOF) {
+		fclose(record_fp);	/* the disk is full, say */
+		record_fp = NULL;
+	}
+}
+
+/*
+ * Exporting
+ */
+
+struct out {
+	char *p;
+	size_t len, size;
+	unsigned char attr, color;	/* what the terminal is set to */
+};
+
+static void out_bytes(struct out *o, const char *p, size_t len)
+{
+	if (o->len + len > o->size) {
+		size_t size = o->size ? o->size : 4096;
+		char *q;
+
+		while (size < o->len + len)
+			size *= 2;
+		if ((q = realloc(o->p, size)) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		o->p = q;
+		o->size = size;
+	}
+	memcpy(o->p + o->len, p, len);
+	o->len += len;
+}
+
+static void out_printf(struct out *o, const char *fmt, int a, int b)
+{
+	char buf[32];
+
+	out_bytes(o, buf, snprintf(buf, sizeof buf, fmt, a, b));
+}
+
+static void out_pen(struct out *o, unsigned char attr, unsigned char color)
+{
+	char buf[32];
+	int n;
+
+	if (attr == o->attr && color == o->color)
+		return;
+	n = snprintf(buf, sizeof buf, "\033[0%s%s", attr & WATCH_BOLD ? ";1" : "",
+	    attr & WATCH_STANDOUT ? ";7" : "");
+	if (color)
+		n += snprintf(buf + n, sizeof buf - n, ";%d", 29 + color);
+	buf[n++] = 'm';
+	out_bytes(o, buf, n);
+	o->attr = attr;
+	o->color = color;
+}
+
+static void out_cell(struct out *o, const struct watch_cell *c)
+{
+	char mb[MB_LEN_MAX];
+	int n;
+
+	if (c->ch == WATCH_WIDE_CONT)
+		return;
+	out_pen(o, c->attr, c->color);
+	if ((n = wctomb(mb, c->ch)) > 0)
+		out_bytes(o, mb, n);
+	if (c->comb && (n = wctomb(mb, c->comb)) > 0)
+		out_bytes(o, mb, n);
+}
+
+/* bring row y of the screen from old to new */
+static void out_row(struct out *o, int y, const struct watch_cell *old,
+    const struct watch_cell *new, int width)
+{
+	int first = 0, last = width - 1, tail = width, x;
+
+	while (first < width && !memcmp(&old[first], &new[first], sizeof *new))
+		first++;
+	if (first == width)
+		return;
+	while (!memcmp(&old[last], &new[last], sizeof *new))
+		last--;
+	while (tail > 0 && blank(&new[tail - 1]))
+		tail--;
+	/* start on the left half of a double-width character */
+	if (first > 0 && (new[first].ch == WATCH_WIDE_CONT || old[first].ch == WATCH_WIDE_CONT))
+		first--;
+	out_printf(o, "\033[%d;%dH", y + 1, first + 1);
+	for (x = first; x <= last && x < tail; x++)
+		out_cell(o, &new[x]);
+	if (last >= tail) {
+		out_pen(o, 0, 0);
+		out_bytes(o, "\033[K", 3);
+	}
+}
+
+/* a JSON string for a cast event */
+static void put_json(const char *p, size_t len, FILE *fp)
+{
+	putc('"', fp);
+	for (; len--; p++) {
+		unsigned char c = *p;
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			putc(c, fp);
+	}
+	putc('"', fp);
+}
+
+int record_export(const char *how, const char *path)
+{
+	struct record_header h;
+	struct record_frame f;
+	struct watch_cell *screen = NULL, *row = NULL;
+	struct out o;
+	FILE *fp, *timing = NULL;
+	watch_usec_t first = 0, prev = 0;
+	int cast = !strcmp(how, "cast"), height = 0, width = 0;
+	unsigned long frames = 0;
+
+	if (!cast && strcmp(how, "raw") && strncmp(how, "raw,", 4)) {
+		fprintf(stderr, "unknown export format '%s'\n", how);
+		return 1;
+	}
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	if (fread(&h, sizeof h, 1, fp) != 1 || memcmp(h.magic, RECORD_MAGIC, sizeof h.magic)
+	    || h.version != RECORD_VERSION || h.cell_size != sizeof (struct watch_cell)) {
+		fprintf(stderr, "%s: not a recording from this watch\n", path);
+		return 1;
+	}
+	if (!strncmp(how, "raw,", 4) && (timing = fopen(how + 4, "w")) == NULL) {
+		perror(how + 4);
+		return 1;
+	}
+	memset(&o, 0, sizeof o);
+
+	while (fread(&f, sizeof f, 1, fp) == 1) {
+		size_t rowbytes;
+		int i, y;
+
+		if (f.height <= 0 || f.width <= 0 || f.rows < 0 || f.rows > f.height)
+			break;
+		rowbytes = f.width * sizeof *screen;
+		o.len = 0;
+		if (!frames++) {
+			first = prev = f.time;
+			if (cast) {
+				printf("{\"version\": 2, \"width\": %d, \"height\": %d, "
+				    "\"timestamp\": %llu, \"env\": {\"TERM\": \"xterm\"}}\n",
+				    f.width, f.height, f.time / USECS_PER_SEC);
+			}
+		}
+		if (f.height != height || f.width != width) {
+			struct watch_cell blank_cell = { L' ', 0, 0, 0 };
+			size_t n = (size_t) f.height * f.width, c;
+
+			free(screen);
+			free(row);
+			screen = malloc(n * sizeof *screen);
+			row = malloc(rowbytes);
+			if (!screen || !row) {
+				perror("malloc");
+				return 1;
+			}
+			for (c = 0; c < n; c++)
+				screen[c] = blank_cell;
+			height = f.height;
+			width = f.width;
+			out_pen(&o, 0, 0);
+			out_bytes(&o, "\033[H\033[2J", 7);
+		}
+		for (i = 0; i < f.rows; i++) {
+			if (fread(&y, sizeof y, 1, fp) != 1 || y < 0 || y >= height
+			    || fread(row, rowbytes, 1, fp) != 1)
+				goto truncated;
+			out_row(&o, y, screen + (size_t) y * width, row, width);
+			memcpy(screen + (size_t) y * width, row, rowbytes);
+		}
+		if (cast) {
+			printf("[%.6f, \"o\", ", (double) (f.time - first) / USECS_PER_SEC);
+			put_json(o.p, o.len, stdout);
+			fputs("]\n", stdout);
+		} else {
+			fwrite(o.p, 1, o.len, stdout);
+			if (timing)
+				fprintf(timing, "%.6f %zu\n",
+				    (double) (f.time - prev) / USECS_PER_SEC, o.len);
+		}
+		prev = f.time;
+	}
+truncated:	/* a watch killed mid-frame: the frames before it stand */
+	fclose(fp);
+	free(screen);
+	free(row);
+	free(o.p);
+	if (timing && fclose(timing) == EOF) {
+		perror(how + 4);
+		return 1;
+	}
+	if (fflush(stdout) == EOF) {
+		perror("stdout");
+		return 1;
+	}
+	return 0;
+}
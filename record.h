@@ -0,0 +1,17 @@
+#ifndef WATCH_RECORD_H
+#define WATCH_RECORD_H
+
+#include "libwatch.h"
+
+/* start recording frames to path; returns 0, or -1 after a message */
+extern int record_open(const char *path);
+
+/* record the frame just drawn */
+extern void record_frame(const struct watch_ctx *w);
+
+/* write a recording to stdout as an asciinema cast ("cast") or as the
+ * bytes a terminal would have been sent ("raw", or "raw,TIMING" to write
+ * scriptreplay timing to TIMING too); returns the exit status */
+extern int record_export(const char *how, const char *path);
+
+#endif
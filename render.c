@@ -0,0 +1,285 @@
+/* render.c -- drawing frames with curses, on a thread of their own
+ *
+ * Drawing used to happen inside watch_step(), so a slow terminal held up
+ * reading the command's output and a chatty command held up repaints.
+ * Now the sink only copies the finished frame into a ring of a few slots,
+ * and the render thread draws from there.  There is one producer (the
+ * event loop) and one consumer (the render thread), so the ring needs no
+ * lock: the producer alone moves head, the consumer alone moves tail.
+ *
+ * The consumer draws only the newest of the frames waiting and drops the
+ * others, after merging their dirty rows into it.  When the ring is full
+ * the producer drops its frame instead and sends the current one again
+ * with render_retry(), all rows dirty, once there is room.
+ *
+ * When a block of rows moved since the frame before (see scroll_by in
+ * libwatch.h) the block is scrolled on the terminal and only the rows
+ * that uncovers are drawn, which for output like that of tail is a few
+ * rows instead of the whole screen.  curses only scrolls the terminal
+ * with idlok() on.
+ */
+
+#define _XOPEN_SOURCE_EXTENDED 1
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ncurses.h>
+#include "render.h"
+
+#define RENDER_SLOTS 4
+
+struct frame {
+	int height, width;
+	struct watch_cell *cells;
+	unsigned char *dirty;
+	size_t cells_size, dirty_size;	/* allocated */
+	int use_color;
+	int scroll_top, scroll_bottom, scroll_by;
+	watch_usec_t run_start;
+};
+
+static struct frame ring[RENDER_SLOTS];
+static unsigned head, tail;	/* frames published, and frames released */
+
+static int threaded;
+static pthread_t render_thread;
+static int wake_fd[2] = { -1, -1 };
+static int quit, bell;		/* set by the producer, cleared by the consumer */
+static int dropped;		/* producer only: a frame did not fit */
+static int dropped_color;
+static void (*drawn)(watch_usec_t run_start);
+
+/* draw the rows that changed, resizing curses first if the frame is not
+ * the size of the screen, and scrolling rows that moved by by (0 for
+ * none) from top to bottom */
+static void draw(const struct watch_cell *cells, const unsigned char *dirty,
+    int height, int width, int use_color, int top, int bottom, int by)
+{
+	int all = 0;
+	int x, y;
+
+	if (height != LINES || width != COLS) {
+		resizeterm(height, width);
+		clear();
+		all = 1;
+		by = 0;
+	}
+	if (by) {
+		setscrreg(top, bottom);
+		scrollok(stdscr, TRUE);
+		scrl(by);
+		scrollok(stdscr, FALSE);
+		setscrreg(0, height - 1);
+	}
+	for (y = 0; y < height; y++) {
+		const struct watch_cell *row = cells + (size_t) y * width;
+		if (by && y >= top && y <= bottom) {
+			/* only the uncovered rows are left to draw */
+			if (by > 0 ? y <= bottom - by : y >= top - by)
+				continue;
+		} else if (!all && !dirty[y])
+			continue;
+		for (x = 0; x < width; x++) {
+			wchar_t wstr[3];
+			attr_t attr = A_NORMAL;
+			cchar_t cc;
+
+			if (row[x].ch == WATCH_WIDE_CONT)
+				continue;
+			wstr[0] = row[x].ch;
+			wstr[1] = row[x].comb;
+			wstr[2] = L'\0';
+			if (row[x].attr & WATCH_BOLD)
+				attr |= A_BOLD;
+			if (row[x].attr & WATCH_STANDOUT)
+				attr |= A_STANDOUT;
+			setcchar(&cc, wstr, attr, use_color ? row[x].color : 0, NULL);
+			mvadd_wch(y, x, &cc);
+		}
+	}
+	refresh();
+}
+
+static void wake(void)
+{
+	if (write(wake_fd[1], "", 1) < 0 && errno != EAGAIN)
+		return;	/* the consumer is gone; nothing to wake */
+}
+
+static void *render_frames(void *notused)
+{
+	unsigned char *dirty = NULL;
+	size_t dirty_size = 0;
+	char buf[64];
+
+	(void) notused;
+	for (;;) {
+		unsigned h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+		unsigned t = tail, i;
+
+		if (h != t) {
+			struct frame *f = &ring[(h - 1) % RENDER_SLOTS];
+			watch_usec_t run_start = f->run_start;
+			int y;
+
+			if (dirty_size < (size_t) f->height) {
+				unsigned char *p = realloc(dirty, f->height);
+				if (p) {
+					dirty = p;
+					dirty_size = f->height;
+				}
+			}
+			if (h - t == 1) {	/* the scroll is from the last frame drawn */
+				draw(f->cells, f->dirty, f->height, f->width, f->use_color,
+				    f->scroll_top, f->scroll_bottom, f->scroll_by);
+			} else if (dirty_size < (size_t) f->height) {
+				draw(f->cells, f->dirty, f->height, f->width, f->use_color,
+				    0, 0, 0);
+			} else {
+				memcpy(dirty, f->dirty, f->height);
+				for (i = t; i != h - 1; i++) {
+					const struct frame *old = &ring[i % RENDER_SLOTS];
+					for (y = 0; y < f->height; y++)
+						if (old->height != f->height
+						    || old->width != f->width || old->dirty[y])
+							dirty[y] = 1;
+				}
+				draw(f->cells, dirty, f->height, f->width, f->use_color,
+				    0, 0, 0);
+			}
+			__atomic_store_n(&tail, h, __ATOMIC_RELEASE);
+			if (drawn)
+				drawn(run_start);
+			continue;
+		}
+		if (__atomic_exchange_n(&bell, 0, __ATOMIC_ACQ_REL)) {
+			beep();
+			continue;
+		}
+		if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE)
+		    && __atomic_load_n(&head, __ATOMIC_ACQUIRE) == tail)
+			break;
+		if (read(wake_fd[0], buf, sizeof buf) < 0 && errno != EINTR)
+			break;
+	}
+	free(dirty);
+	return NULL;
+}
+
+static void publish(struct watch_ctx *w, int use_color)
+{
+	unsigned h = head;
+	size_t cells = (size_t) w->height * w->width;
+	struct frame *f;
+
+	if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == RENDER_SLOTS)
+		goto drop;
+	f = &ring[h % RENDER_SLOTS];
+	if (f->cells_size < cells) {
+		struct watch_cell *p = realloc(f->cells, cells * sizeof *p);
+		if (!p)
+			goto drop;
+		f->cells = p;
+		f->cells_size = cells;
+	}
+	if (f->dirty_size < (size_t) w->height) {
+		unsigned char *p = realloc(f->dirty, w->height);
+		if (!p)
+			goto drop;
+		f->dirty = p;
+		f->dirty_size = w->height;
+	}
+	f->height = w->height;
+	f->width = w->width;
+	memcpy(f->cells, w->cells, cells * sizeof *f->cells);
+	if (dropped) {	/* rows of the lost frame may have changed too */
+		memset(f->dirty, 1, w->height);
+		f->scroll_by = 0;
+	} else {
+		memcpy(f->dirty, w->dirty, w->height);
+		f->scroll_top = w->scroll_top;
+		f->scroll_bottom = w->scroll_bottom;
+		f->scroll_by = w->scroll_by;
+	}
+	f->use_color = use_color;
+	f->run_start = w->run_start;
+	dropped = 0;
+	__atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+	wake();
+	return;
+drop:
+	dropped = 1;
+	dropped_color = use_color;
+}
+
+void render_sink(struct watch_ctx *w, void *arg)
+{
+	int use_color = *(int *) arg;
+
+	if (threaded)
+		publish(w, use_color);
+	else
+		draw(w->cells, w->dirty, w->height, w->width, use_color,
+		    w->scroll_top, w->scroll_bottom, w->scroll_by);
+}
+
+int render_start(void (*drawn_func)(watch_usec_t run_start))
+{
+	sigset_t all, old;
+	int r;
+
+	if (pipe(wake_fd) < 0)
+		return -1;
+	fcntl(wake_fd[1], F_SETFL, O_NONBLOCK);
+	fcntl(wake_fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(wake_fd[1], F_SETFD, FD_CLOEXEC);
+	drawn = drawn_func;
+
+	/* signals are for the event loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	r = pthread_create(&render_thread, NULL, render_frames, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (r) {
+		close(wake_fd[0]);
+		close(wake_fd[1]);
+		return -1;
+	}
+	threaded = 1;
+	return 0;
+}
+
+void render_stop(void)
+{
+	if (!threaded)
+		return;
+	__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+	wake();
+	pthread_join(render_thread, NULL);
+	threaded = 0;
+}
+
+int render_pending(void)
+{
+	return dropped;
+}
+
+void render_retry(struct watch_ctx *w)
+{
+	if (dropped && threaded)
+		publish(w, dropped_color);
+}
+
+void render_beep(void)
+{
+	if (threaded) {
+		__atomic_store_n(&bell, 1, __ATOMIC_RELEASE);
+		wake();
+	} else
+		beep();
+}
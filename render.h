@@ -0,0 +1,29 @@
+#ifndef WATCH_RENDER_H
+#define WATCH_RENDER_H
+
+#include "libwatch.h"
+
+/* the curses sink; arg points to whether colors are usable.  Frames are
+ * drawn on the spot until render_start() is called, and from then on by
+ * the render thread. */
+extern void render_sink(struct watch_ctx *w, void *arg);
+
+/* draw frames on a thread of their own, which is the only one to use
+ * curses until render_stop(); drawn, if not NULL, is called there after
+ * each frame with the start of the run it shows.  Returns -1 if the
+ * thread cannot be started, and frames go on being drawn on the spot. */
+extern int render_start(void (*drawn)(watch_usec_t run_start));
+
+/* draw whatever frame is still queued, and stop the thread */
+extern void render_stop(void);
+
+/* a frame found the queue full and waits to be sent again with
+ * render_retry(), which should be within RENDER_RETRY_USEC */
+#define RENDER_RETRY_USEC	10000
+extern int render_pending(void);
+extern void render_retry(struct watch_ctx *w);
+
+/* ring the bell from the thread that owns the terminal */
+extern void render_beep(void);
+
+#endif
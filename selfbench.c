@@ -0,0 +1,471 @@
+/* selfbench.c -- measure the cost of the ways watch could run a command
+ *
+ * `watch --self-benchmark=spawn[:iterations] [command]` runs /bin/true,
+ * and the given command if there is one, through each spawn strategy and
+ * prints per-iteration latency and CPU cost with a log2 histogram, so the
+ * cheapest mode for a given kernel and memory footprint can be picked
+ * with data instead of folklore.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "procps.h"
+#include "selfbench.h"
+
+extern char **environ;
+
+#define BENCH_BUCKETS 32	/* log2(usec) buckets, plenty for a 2^31us run */
+#define BENCH_BAR 40		/* width of the longest histogram bar */
+
+struct bench_target {
+	const char *label;
+	const char *command;	/* for the strategies that go through sh */
+	char *const *argv;	/* for the strategies that exec directly */
+};
+
+struct bench_result {
+	unsigned long long min, max, total;
+	unsigned long long *samples;
+	unsigned long buckets[BENCH_BUCKETS];
+	double cpu_self, cpu_children;	/* seconds, summed over the run */
+	int failures;
+};
+
+/* a strategy runs the target once, draining its output, and returns the
+ * wall time it took in usec, or -1 on a setup failure */
+struct bench_strategy {
+	const char *name;
+	void (*setup)(const struct bench_target *t);
+	long long (*run)(const struct bench_target *t, int *status);
+	void (*teardown)(void);
+};
+
+static unsigned long long mono_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000ull * ts.tv_sec + ts.tv_nsec / 1000;
+}
+
+static double rusage_seconds(int who)
+{
+	struct rusage ru;
+	getrusage(who, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+	    + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* read and throw away everything on fd until EOF */
+static void drain(int fd)
+{
+	char buf[4096];
+	ssize_t n;
+	do
+		n = read(fd, buf, sizeof buf);
+	while (n > 0 || (n < 0 && errno == EINTR));
+}
+
+static void child_stdio(int pipefd[2])
+{
+	close(pipefd[0]);
+	if (dup2(pipefd[1], 1) < 0)
+		_exit(3);
+	dup2(1, 2);
+	close(pipefd[1]);
+}
+
+static int reap(pid_t child)
+{
+	int status;
+	while (waitpid(child, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	return status;
+}
+
+/* fork + system(): what watch does without -x */
+static long long run_system(const struct bench_target *t, int *status)
+{
+	int pipefd[2];
+	unsigned long long start = mono_usec();
+	pid_t child;
+
+	if (pipe(pipefd) < 0)
+		return -1;
+	child = fork();
+	if (child < 0)
+		return -1;
+	if (child == 0) {
+		int s;
+		child_stdio(pipefd);
+		s = system(t->command);
+		_exit(WIFEXITED(s) ? WEXITSTATUS(s) : 1);
+	}
+	close(pipefd[1]);
+	drain(pipefd[0]);
+	close(pipefd[0]);
+	*status = reap(child);
+	return mono_usec() - start;
+}
+
+/* fork + execvp(): what watch does with -x */
+static long long run_fork_exec(const struct bench_target *t, int *status)
+{
+	int pipefd[2];
+	unsigned long long start = mono_usec();
+	pid_t child;
+
+	if (pipe(pipefd) < 0)
+		return -1;
+	child = fork();
+	if (child < 0)
+		return -1;
+	if (child == 0) {
+		child_stdio(pipefd);
+		execvp(t->argv[0], t->argv);
+		_exit(4);
+	}
+	close(pipefd[1]);
+	drain(pipefd[0]);
+	close(pipefd[0]);
+	*status = reap(child);
+	return mono_usec() - start;
+}
+
+/* vfork + execvp(): the parent is suspended until the exec, but the page
+ * tables are never copied */
+static long long run_vfork_exec(const struct bench_target *t, int *status)
+{
+	int pipefd[2];
+	unsigned long long start = mono_usec();
+	pid_t child;
+
+	if (pipe(pipefd) < 0)
+		return -1;
+	child = vfork();
+	if (child < 0)
+		return -1;
+	if (child == 0) {
+		/* only async-signal-safe calls on the shared stack */
+		close(pipefd[0]);
+		dup2(pipefd[1], 1);
+		dup2(1, 2);
+		execvp(t->argv[0], t->argv);
+		_exit(4);
+	}
+	close(pipefd[1]);
+	drain(pipefd[0]);
+	close(pipefd[0]);
+	*status = reap(child);
+	return mono_usec() - start;
+}
+
+static long long run_posix_spawn(const struct bench_target *t, int *status)
+{
+	int pipefd[2];
+	unsigned long long start = mono_usec();
+	posix_spawn_file_actions_t fa;
+	pid_t child;
+	int err;
+
+	if (pipe(pipefd) < 0)
+		return -1;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addclose(&fa, pipefd[0]);
+	posix_spawn_file_actions_adddup2(&fa, pipefd[1], 1);
+	posix_spawn_file_actions_adddup2(&fa, 1, 2);
+	err = posix_spawnp(&child, t->argv[0], &fa, NULL, t->argv, environ);
+	posix_spawn_file_actions_destroy(&fa);
+	close(pipefd[1]);
+	if (err) {
+		close(pipefd[0]);
+		return -1;
+	}
+	drain(pipefd[0]);
+	close(pipefd[0]);
+	*status = reap(child);
+	return mono_usec() - start;
+}
+
+/* persistent shell: one sh reads commands from a pipe and reports each
+ * exit status after a marker line, so only the command itself is spawned */
+static pid_t shell_pid = -1;
+static FILE *shell_in, *shell_out;
+static char shell_marker[48];
+
+static void setup_shell(const struct bench_target *t)
+{
+	int to_sh[2], from_sh[2];
+
+	(void) t;
+	if (pipe(to_sh) < 0 || pipe(from_sh) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	shell_pid = fork();
+	if (shell_pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (shell_pid == 0) {
+		close(to_sh[1]);
+		close(from_sh[0]);
+		dup2(to_sh[0], 0);
+		dup2(from_sh[1], 1);
+		dup2(1, 2);
+		execl("/bin/sh", "sh", (char *) NULL);
+		_exit(4);
+	}
+	close(to_sh[0]);
+	close(from_sh[1]);
+	shell_in = fdopen(to_sh[1], "w");
+	shell_out = fdopen(from_sh[0], "r");
+	snprintf(shell_marker, sizeof shell_marker, "__watch_bench_%ld", (long) getpid());
+}
+
+static long long run_shell(const struct bench_target *t, int *status)
+{
+	unsigned long long start = mono_usec();
+	size_t mlen = strlen(shell_marker);
+	char line[4096];
+
+	fprintf(shell_in, "{ %s\n} </dev/null 2>&1; printf '\\n%s %%d\\n' $?\n",
+	    t->command, shell_marker);
+	fflush(shell_in);
+	while (fgets(line, sizeof line, shell_out)) {
+		if (!strncmp(line, shell_marker, mlen) && line[mlen] == ' ') {
+			/* fake up a wait status so the caller treats it alike */
+			*status = (atoi(line + mlen + 1) & 0xff) << 8;
+			return mono_usec() - start;
+		}
+	}
+	return -1;
+}
+
+static void teardown_shell(void)
+{
+	fclose(shell_in);
+	fclose(shell_out);
+	reap(shell_pid);
+	shell_pid = -1;
+}
+
+/* standby child: forked ahead of time and parked on a pipe, so the timed
+ * part is only the wakeup and the exec; the fork is paid between ticks */
+static pid_t standby_pid = -1;
+static int standby_go = -1, standby_out = -1;
+
+static void prefork_standby(const struct bench_target *t)
+{
+	int go[2], out[2];
+
+	if (pipe(go) < 0 || pipe(out) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	standby_pid = fork();
+	if (standby_pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (standby_pid == 0) {
+		char c;
+		close(go[1]);
+		child_stdio(out);
+		if (read(go[0], &c, 1) != 1)
+			_exit(0);
+		close(go[0]);
+		execvp(t->argv[0], t->argv);
+		_exit(4);
+	}
+	close(go[0]);
+	close(out[1]);
+	standby_go = go[1];
+	standby_out = out[0];
+}
+
+static long long run_standby(const struct bench_target *t, int *status)
+{
+	unsigned long long start = mono_usec(), elapsed;
+
+	if (write(standby_go, "", 1) != 1)
+		return -1;
+	close(standby_go);
+	drain(standby_out);
+	close(standby_out);
+	*status = reap(standby_pid);
+	elapsed = mono_usec() - start;
+	prefork_standby(t);
+	return elapsed;
+}
+
+static void teardown_standby(void)
+{
+	close(standby_go);	/* the parked child sees EOF and leaves */
+	close(standby_out);
+	reap(standby_pid);
+	standby_pid = -1;
+}
+
+static const struct bench_strategy strategies[] = {
+	{ "fork+system", NULL, run_system, NULL },
+	{ "fork+execvp", NULL, run_fork_exec, NULL },
+	{ "vfork+execvp", NULL, run_vfork_exec, NULL },
+	{ "posix_spawnp", NULL, run_posix_spawn, NULL },
+	{ "persistent sh", setup_shell, run_shell, teardown_shell },
+	{ "standby child", prefork_standby, run_standby, teardown_standby },
+};
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+	return (x > y) - (x < y);
+}
+
+static void bench_one(const struct bench_strategy *s, const struct bench_target *t,
+    int iterations, struct bench_result *r)
+{
+	double self0, children0;
+	int i;
+
+	memset(r, 0, sizeof *r);
+	r->min = ~0ull;
+	r->samples = malloc(iterations * sizeof *r->samples);
+	if (r->samples == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	if (s->setup)
+		s->setup(t);
+	self0 = rusage_seconds(RUSAGE_SELF);
+	children0 = rusage_seconds(RUSAGE_CHILDREN);
+	for (i = 0; i < iterations; i++) {
+		int status = 0, b = 0;
+		long long us = s->run(t, &status);
+		if (us < 0) {
+			perror(s->name);
+			exit(1);
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			r->failures++;
+		r->samples[i] = us;
+		r->total += us;
+		if ((unsigned long long) us < r->min)
+			r->min = us;
+		if ((unsigned long long) us > r->max)
+			r->max = us;
+		while (us > 1 && b < BENCH_BUCKETS - 1) {
+			us >>= 1;
+			b++;
+		}
+		r->buckets[b]++;
+	}
+	if (s->teardown)
+		s->teardown();
+	/* children of the persistent shell are only counted once it is reaped */
+	r->cpu_self = rusage_seconds(RUSAGE_SELF) - self0;
+	r->cpu_children = rusage_seconds(RUSAGE_CHILDREN) - children0;
+	qsort(r->samples, iterations, sizeof *r->samples, cmp_ull);
+}
+
+static void report(const struct bench_strategy *s, const struct bench_result *r,
+    int iterations)
+{
+	unsigned long peak = 0;
+	int b, lo = BENCH_BUCKETS, hi = 0;
+
+	printf("  %-14s min %7llu  p50 %7llu  p99 %7llu  max %7llu  avg %9.1f us"
+	    "  cpu/iter self %6.1f children %7.1f us",
+	    s->name, r->min, r->samples[iterations / 2],
+	    r->samples[(int) (iterations * 0.99)], r->max,
+	    (double) r->total / iterations,
+	    1e6 * r->cpu_self / iterations, 1e6 * r->cpu_children / iterations);
+	if (r->failures)
+		printf("  (%d non-zero exits)", r->failures);
+	putchar('\n');
+
+	for (b = 0; b < BENCH_BUCKETS; b++) {
+		if (!r->buckets[b])
+			continue;
+		if (b < lo)
+			lo = b;
+		hi = b;
+		if (r->buckets[b] > peak)
+			peak = r->buckets[b];
+	}
+	for (b = lo; b <= hi; b++) {
+		int len = (int) ((r->buckets[b] * BENCH_BAR + peak - 1) / peak);
+		printf("    %8llu us |%-*.*s| %lu\n", 1ull << b, BENCH_BAR, len,
+		    "########################################", r->buckets[b]);
+	}
+}
+
+static void bench_target(const struct bench_target *t, int iterations)
+{
+	struct bench_result r;
+	size_t i;
+
+	printf("%s (%d iterations):\n", t->label, iterations);
+	for (i = 0; i < sizeof strategies / sizeof strategies[0]; i++) {
+		bench_one(&strategies[i], t, iterations, &r);
+		report(&strategies[i], &r, iterations);
+		free(r.samples);
+	}
+	putchar('\n');
+}
+
+int self_benchmark(const char *spec, const char *command, char **command_argv,
+    int option_exec)
+{
+	static char *const true_argv[] = { "/bin/true", NULL };
+	char *sh_argv[] = { "/bin/sh", "-c", (char *) command, NULL };
+	struct bench_target t;
+	int iterations = 1000;
+	size_t kindlen = strcspn(spec, ":");
+
+	if (kindlen != 5 || strncmp(spec, "spawn", 5)) {
+		fprintf(stderr, "unknown self-benchmark '%.*s', 'spawn' and 'soak' are supported\n",
+		    (int) kindlen, spec);
+		return 1;
+	}
+	if (spec[kindlen] == ':') {
+		char *end;
+		long n = strtol(spec + kindlen + 1, &end, 10);
+		if (*end || n < 1 || n > 10000000) {
+			fprintf(stderr, "bad iteration count '%s'\n", spec + kindlen + 1);
+			return 1;
+		}
+		iterations = (int) n;
+	}
+
+	/* keep a SIGCHLD disposition from some parent shell from eating our
+	 * children's statuses */
+	signal(SIGCHLD, SIG_DFL);
+
+	t.label = "/bin/true";
+	t.command = "/bin/true";
+	t.argv = true_argv;
+	bench_target(&t, iterations);
+
+	if (command) {
+		t.label = command;
+		t.command = command;
+		/* without -x watch hands the command to sh, so the direct-exec
+		 * strategies have to as well to be comparable */
+		t.argv = option_exec ? command_argv : sh_argv;
+		bench_target(&t, iterations);
+	}
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef WATCH_SELFBENCH_H
+#define WATCH_SELFBENCH_H
+
+/* run the --self-benchmark given by spec ("spawn[:iterations]") against
+ * /bin/true and, if not NULL, command; returns the exit status for main */
+extern int self_benchmark(const char *spec, const char *command,
+    char **command_argv, int option_exec);
+
+#endif
@@ -0,0 +1,121 @@
+/* simulate.c -- scripted command outputs for --simulate
+ *
+ * A script has one run of the command per line:
+ *
+ *	DURATION EXIT OUTPUT
+ *
+ * DURATION is in seconds, EXIT is the exit status, and OUTPUT is the rest
+ * of the line with C-style escapes (\n, \t, \e, \\, \ooo).  Blank lines
+ * and lines starting with '#' are skipped.  The steps are replayed in
+ * order, cycling, until RUNS of them have run (one pass by default).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "simulate.h"
+
+static struct sim_step *steps;
+static size_t nsteps;
+static unsigned long runs_left, next_step;
+
+/* decode the escapes in place, returning the decoded length */
+static size_t unescape(char *s)
+{
+	char *start = s, *out = s;
+
+	while (*s) {
+		if (*s != '\\' || !s[1]) {
+			*out++ = *s++;
+			continue;
+		}
+		s++;
+		switch (*s) {
+		case 'n': *out++ = '\n'; s++; break;
+		case 't': *out++ = '\t'; s++; break;
+		case 'r': *out++ = '\r'; s++; break;
+		case 'e': *out++ = '\033'; s++; break;
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7': {
+			int i, c = 0;
+			for (i = 0; i < 3 && *s >= '0' && *s <= '7'; i++)
+				c = c * 8 + *s++ - '0';
+			*out++ = (char) c;
+			break;
+		}
+		default: *out++ = *s++; break;
+		}
+	}
+	*out = '\0';
+	return out - start;
+}
+
+int sim_load(const char *spec)
+{
+	char *path = strdup(spec), *comma = strrchr(path, ',');
+	char line[8192];
+	unsigned lineno = 0;
+	FILE *fp;
+
+	runs_left = 0;
+	if (comma) {
+		char *end;
+		*comma = '\0';
+		runs_left = strtoul(comma + 1, &end, 10);
+		if (!comma[1] || *end || !runs_left) {
+			fprintf(stderr, "bad simulation run count '%s'\n", comma + 1);
+			return -1;
+		}
+	}
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof line, fp)) {
+		struct sim_step *step;
+		double duration;
+		int status, off = 0;
+		char *text;
+
+		lineno++;
+		line[strcspn(line, "\n")] = '\0';
+		for (text = line; isspace((unsigned char) *text); text++)
+			;
+		if (!*text || *text == '#')
+			continue;
+		if (sscanf(text, "%lf %d %n", &duration, &status, &off) < 2
+		    || duration < 0 || status < 0 || status > 255) {
+			fprintf(stderr, "%s:%u: expected DURATION EXIT OUTPUT\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		steps = realloc(steps, (nsteps + 1) * sizeof *steps);
+		step = &steps[nsteps++];
+		step->duration = (unsigned long long) (duration * 1000000);
+		step->status = status << 8;	/* as WEXITSTATUS() expects */
+		step->output = strdup(text + off);
+		step->length = unescape(step->output);
+	}
+	fclose(fp);
+	free(path);
+	if (!nsteps) {
+		fprintf(stderr, "%s: no runs in simulation script\n", spec);
+		return -1;
+	}
+	if (!runs_left)
+		runs_left = nsteps;
+	return 0;
+}
+
+const struct sim_step *sim_next(void)
+{
+	const struct sim_step *step;
+
+	if (!runs_left)
+		return NULL;
+	runs_left--;
+	step = &steps[next_step];
+	next_step = (next_step + 1) % nsteps;
+	return step;
+}
@@ -0,0 +1,20 @@
+#ifndef WATCH_SIMULATE_H
+#define WATCH_SIMULATE_H
+
+#include <stddef.h>
+
+/* one scripted run of the command */
+struct sim_step {
+	unsigned long long duration;	/* usec the command "runs" for */
+	int status;			/* exit status, as from waitpid */
+	char *output;
+	size_t length;
+};
+
+/* load a --simulate spec, "FILE[,RUNS]"; returns 0 or -1 after a message */
+extern int sim_load(const char *spec);
+
+/* the next step to run, or NULL once RUNS steps have been handed out */
+extern const struct sim_step *sim_next(void);
+
+#endif
@@ -0,0 +1,254 @@
+/* soak.c -- run watch for a long time, fast, and check nothing grows
+ *
+ * `watch --self-benchmark=soak[:ticks] command` drives the same pipeline
+ * watch runs, on a virtual clock so no time is spent waiting between
+ * runs: every tick the command is spawned, its output read, the frame
+ * laid out and compared, the child reaped, and the frame handed on as
+ * the main loop does, to be drawn by curses (into /dev/null) and kept by
+ * --state, --history, --record and the like.  A tick whose run was left
+ * out, by --guard say, ends there.  Along the way it samples the
+ * resident set, the heap in use, the open file descriptors and how long
+ * the ticks took, and prints the samples.  After a warm-up, while
+ * --history and the like fill up, any growth that keeps up to the end
+ * fails it: a leak of a few bytes a run is months of a watch away from
+ * showing, but not millions of runs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "soak.h"
+
+#define SOAK_TICKS 100000	/* unless told otherwise */
+#define SOAK_SAMPLES 20
+#define SOAK_WARMUP 4		/* samples before the baseline */
+/* growth allowed from the baseline to the end */
+#define SOAK_SLACK_HEAP (64 * 1024)
+#define SOAK_SLACK_RSS (512 * 1024)	/* pages come and go */
+
+struct sample {
+	unsigned long long tick;
+	long rss, heap;		/* bytes, -1 when unknown */
+	int fds;
+	unsigned long long p50, p99, max;	/* tick latency in usec */
+};
+
+static watch_usec_t soak_now;
+
+static watch_usec_t soak_clock(void *notused)
+{
+	(void) notused;
+	return soak_now;
+}
+
+static unsigned long long mono_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000ull * ts.tv_sec + ts.tv_nsec / 1000;
+}
+
+static long resident_bytes(void)
+{
+	FILE *fp = fopen("/proc/self/statm", "r");
+	long size, resident = -1;
+
+	if (fp) {
+		if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+			resident = -1;
+		fclose(fp);
+	}
+	return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE);
+}
+
+static long heap_bytes(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+#else
+	return -1;
+#endif
+}
+
+static int open_fds(void)
+{
+	long max = sysconf(_SC_OPEN_MAX);
+	int fd, n = 0;
+
+	if (max < 0 || max > 65536)
+		max = 65536;
+	for (fd = 0; fd < max; fd++)
+		if (fcntl(fd, F_GETFD) >= 0)
+			n++;
+	return n;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+	return (x > y) - (x < y);
+}
+
+/* one run, from due to drawn, or to left out; returns its wall time in
+ * usec */
+static long long tick(struct watch_ctx *w,
+    void (*frame)(struct watch_ctx *w, watch_usec_t frame_start))
+{
+	unsigned long long start = mono_usec();
+	watch_usec_t frame_start = watch_time_usec();
+	int r;
+
+	do {
+		long long timeout = watch_timeout(w);
+		struct pollfd pfd;
+
+		if (w->state == WATCH_IDLE) {
+			if (timeout > 0)	/* skip the wait */
+				soak_now += timeout;
+		} else if (timeout != 0) {
+			pfd.fd = watch_fd(w);
+			pfd.events = POLLIN;
+			if (poll(&pfd, pfd.fd >= 0, timeout < 0 ? -1
+			    : (int) ((timeout + 999) / 1000)) < 0 && errno != EINTR)
+				return -1;
+		}
+		if ((r = watch_step(w)) < 0)
+			return -1;
+	} while (w->state != WATCH_IDLE);
+	if (r & WATCH_FRAME)
+		frame(w, frame_start);
+	return mono_usec() - start;
+}
+
+/* least squares slope of y over the samples from first on */
+static double slope(const struct sample *s, int first, int n,
+    double (*y)(const struct sample *))
+{
+	double mx = 0, my = 0, sxy = 0, sxx = 0;
+	int i, k = n - first;
+
+	for (i = first; i < n; i++) {
+		mx += s[i].tick;
+		my += y(&s[i]);
+	}
+	mx /= k;
+	my /= k;
+	for (i = first; i < n; i++) {
+		sxy += (s[i].tick - mx) * (y(&s[i]) - my);
+		sxx += (s[i].tick - mx) * (s[i].tick - mx);
+	}
+	return sxx ? sxy / sxx : 0;
+}
+
+static double y_rss(const struct sample *s) { return s->rss; }
+static double y_heap(const struct sample *s) { return s->heap; }
+static double y_fds(const struct sample *s) { return s->fds; }
+
+/* growth from the baseline to the end beyond slack, still going at the
+ * end, is a leak; prints the verdict and returns 1 for one */
+static int check(FILE *out, const char *what, const struct sample *s,
+    int n, double (*y)(const struct sample *), double slack, double unit)
+{
+	double growth = y(&s[n - 1]) - y(&s[SOAK_WARMUP]);
+	double per = slope(s, SOAK_WARMUP, n, y) * 1e6;
+	int leak = growth > slack && per > 0;
+
+	if (y(&s[0]) < 0) {
+		fprintf(out, "  %-5s not known here\n", what);
+		return 0;
+	}
+	fprintf(out,
+	    "  %-5s %+.0f%s after warm-up, %+.1f%s per million ticks: %s\n",
+	    what, growth / unit, unit > 1 ? " kB" : "", per / unit,
+	    unit > 1 ? " kB" : "", leak ? "GROWING" : "flat");
+	return leak;
+}
+
+unsigned long long soak_parse(const char *spec)
+{
+	unsigned long long ticks = SOAK_TICKS;
+
+	if (spec[4] == ':') {
+		char *end;
+		ticks = strtoull(spec + 5, &end, 10);
+		if (*end || ticks < SOAK_SAMPLES) {
+			fprintf(stderr, "bad tick count '%s'\n", spec + 5);
+			return 0;
+		}
+	} else if (spec[4]) {
+		fprintf(stderr, "unknown self-benchmark '%s'\n", spec);
+		return 0;
+	}
+	return ticks;
+}
+
+int soak(struct watch_ctx *w, unsigned long long ticks, FILE *out,
+    void (*frame)(struct watch_ctx *w, watch_usec_t frame_start))
+{
+	struct watch_clock clock = { soak_clock, NULL };
+	struct sample s[SOAK_SAMPLES];
+	unsigned long long *lat, every = ticks / SOAK_SAMPLES, t;
+	int n = 0, failed = 0;
+
+	/* everything the harness needs is allocated before the first sample */
+	if ((lat = malloc(every * sizeof *lat)) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+	signal(SIGCHLD, SIG_DFL);
+	soak_now = watch_time_usec();
+	watch_set_clock(w, &clock);
+
+	fprintf(out, "soak: %llu ticks of %s, sampled every %llu\n",
+	    every * SOAK_SAMPLES, w->opt.command, every);
+	fprintf(out, "  %12s %10s %10s %5s %8s %8s %8s\n", "tick", "rss kB",
+	    "heap kB", "fds", "p50 us", "p99 us", "max us");
+	fflush(out);
+	for (t = 0; n < SOAK_SAMPLES; ) {
+		long long us = tick(w, frame);
+
+		if (us < 0) {
+			perror(w->errfunc ? w->errfunc : "poll");
+			return 1;
+		}
+		lat[t++ % every] = us;
+		if (t % every)
+			continue;
+		qsort(lat, every, sizeof *lat, cmp_ull);
+		s[n].tick = t;
+		s[n].rss = resident_bytes();
+		s[n].heap = heap_bytes();
+		s[n].fds = open_fds();
+		s[n].p50 = lat[every / 2];
+		s[n].p99 = lat[(every * 99) / 100];
+		s[n].max = lat[every - 1];
+		fprintf(out, "  %12llu %10ld %10ld %5d %8llu %8llu %8llu\n",
+		    s[n].tick, s[n].rss < 0 ? -1 : s[n].rss / 1024,
+		    s[n].heap < 0 ? -1 : s[n].heap / 1024, s[n].fds,
+		    s[n].p50, s[n].p99, s[n].max);
+		fflush(out);
+		n++;
+	}
+	free(lat);
+
+	failed |= check(out, "rss", s, n, y_rss, SOAK_SLACK_RSS, 1024);
+	failed |= check(out, "heap", s, n, y_heap, SOAK_SLACK_HEAP, 1024);
+	failed |= check(out, "fds", s, n, y_fds, 0, 1);
+	fprintf(out, "  tick p50 %llu us at the start, %llu us at the end\n",
+	    s[0].p50, s[n - 1].p50);
+	fprintf(out, "%s\n", failed ? "FAILED: something grows" : "ok");
+	fflush(out);
+	return failed;
+}
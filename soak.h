@@ -0,0 +1,18 @@
+#ifndef WATCH_SOAK_H
+#define WATCH_SOAK_H
+
+#include <stdio.h>
+#include "libwatch.h"
+
+/* the ticks a "soak[:ticks]" --self-benchmark asks for, or 0 after
+ * saying what is wrong with spec */
+extern unsigned long long soak_parse(const char *spec);
+
+/* run the soak for ticks with w, which must not have run yet, handing
+ * each frame to frame as the main loop would; prints samples and a
+ * verdict to out and returns the exit status for main, 1 if memory or
+ * file descriptors kept growing */
+extern int soak(struct watch_ctx *w, unsigned long long ticks, FILE *out,
+    void (*frame)(struct watch_ctx *w, watch_usec_t frame_start));
+
+#endif
@@ -0,0 +1,129 @@
+/* state.c -- the --state file
+ *
+ * The file holds what a restarted watch needs to carry on where the last
+ * one stopped: the last frame, with its highlighting (which is the
+ * cumulative change map under --differences=cumulative), and the history
+ * of the runs (see struct watch_history).  It is mapped shared and
+ * updated in place after every frame, so saving costs a memcpy and the
+ * kernel writes it back when it likes; even a watch that is killed
+ * leaves its last frame behind.
+ *
+ * A file from another version of watch, or for another layout of the
+ * cells, is ignored and overwritten.  So is a frame that was being
+ * written when watch died, though its history is still used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "state.h"
+
+#define STATE_MAGIC	"watchst"
+#define STATE_VERSION	1
+
+struct state_header {
+	char magic[8];		/* STATE_MAGIC */
+	unsigned version;	/* STATE_VERSION */
+	unsigned cell_size;	/* sizeof (struct watch_cell) */
+	unsigned serial;	/* odd while the frame is being written */
+	int height, width;
+	struct watch_history hist;
+	/* height * width cells follow */
+};
+
+static int state_fd = -1;
+static struct state_header *map;
+static size_t map_size;
+
+int state_open(const char *path)
+{
+	if ((state_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		perror(path);
+		return -1;
+	}
+	fcntl(state_fd, F_SETFD, FD_CLOEXEC);
+	if (flock(state_fd, LOCK_EX | LOCK_NB) < 0) {
+		if (errno == EWOULDBLOCK)
+			fprintf(stderr, "%s: in use by another watch\n", path);
+		else
+			perror(path);
+		close(state_fd);
+		state_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static size_t state_size(int height, int width)
+{
+	return sizeof(struct state_header)
+	    + (size_t) height * width * sizeof(struct watch_cell);
+}
+
+void state_restore(struct watch_ctx *w)
+{
+	const struct state_header *h;
+	const struct watch_cell *cells = NULL;
+	struct stat st;
+
+	if (state_fd < 0 || fstat(state_fd, &st) < 0
+	    || (size_t) st.st_size < sizeof *h)
+		return;
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, state_fd, 0);
+	if (h == MAP_FAILED)
+		return;
+	if (!memcmp(h->magic, STATE_MAGIC, sizeof h->magic)
+	    && h->version == STATE_VERSION
+	    && h->cell_size == sizeof(struct watch_cell)) {
+		if (!(h->serial & 1) && h->height > 0 && h->width > 0
+		    && (size_t) st.st_size >= state_size(h->height, h->width))
+			cells = (const struct watch_cell *) (h + 1);
+		watch_restore(w, &h->hist, cells, h->height, h->width);
+	}
+	munmap((void *) h, st.st_size);
+}
+
+/* map the file at the size for the current screen */
+static int state_map(const struct watch_ctx *w)
+{
+	size_t size = state_size(w->height, w->width);
+	void *p;
+
+	if (map && map_size == size)
+		return 0;
+	if (map) {
+		munmap(map, map_size);
+		map = NULL;
+	}
+	if (ftruncate(state_fd, size) < 0)
+		return -1;
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, state_fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	map = p;
+	map_size = size;
+	memcpy(map->magic, STATE_MAGIC, sizeof map->magic);
+	map->version = STATE_VERSION;
+	map->cell_size = sizeof(struct watch_cell);
+	return 0;
+}
+
+void state_save(const struct watch_ctx *w)
+{
+	if (state_fd < 0 || state_map(w) < 0)
+		return;	/* out of space, say; watch goes on without */
+	map->serial |= 1;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	map->height = w->height;
+	map->width = w->width;
+	map->hist = w->hist;
+	memcpy(map + 1, w->cells, (size_t) w->height * w->width * sizeof *w->cells);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	map->serial++;
+}
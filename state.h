@@ -0,0 +1,16 @@
+#ifndef WATCH_STATE_H
+#define WATCH_STATE_H
+
+#include "libwatch.h"
+
+/* open (creating if need be) and lock the --state file; returns 0, or
+ * -1 after a message */
+extern int state_open(const char *path);
+
+/* carry on from what the file holds, if anything usable */
+extern void state_restore(struct watch_ctx *w);
+
+/* record the frame just drawn and the history behind it */
+extern void state_save(const struct watch_ctx *w);
+
+#endif
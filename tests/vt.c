@@ -0,0 +1,440 @@
+/* vt.c -- a screen model of the terminal watch draws on, for the tests
+ *
+ * Enough of xterm for what curses sends it with TERM=xterm: UTF-8 text
+ * with auto-margins, cursor addressing and movement, erasing, inserting
+ * and deleting characters and lines, scroll regions and scrolling.
+ * Attributes, modes and the like are read and ignored; sequences it
+ * does not know are counted, so a test can tell it fell behind.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "vt.h"
+
+enum { GROUND, ESCAPE, CSI, STRING, CHARSET };
+
+static int clamp(int v, int lo, int hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void blank(struct vt *t, int y, int from, int to)
+{
+	for (; from < to; from++)
+		t->cell[y][from] = ' ';
+}
+
+static void blank_rows(struct vt *t, int from, int to)
+{
+	for (; from < to; from++)
+		blank(t, from, 0, t->cols);
+}
+
+/* move rows top..bottom up by n, blanking the ones uncovered */
+static void scroll_up(struct vt *t, int top, int bottom, int n)
+{
+	int y;
+
+	n = clamp(n, 0, bottom - top + 1);
+	for (y = top; y + n <= bottom; y++)
+		memcpy(t->cell[y], t->cell[y + n], sizeof t->cell[y]);
+	blank_rows(t, bottom - n + 1, bottom + 1);
+}
+
+static void scroll_down(struct vt *t, int top, int bottom, int n)
+{
+	int y;
+
+	n = clamp(n, 0, bottom - top + 1);
+	for (y = bottom; y - n >= top; y--)
+		memcpy(t->cell[y], t->cell[y - n], sizeof t->cell[y]);
+	blank_rows(t, top, top + n);
+}
+
+static void move_to(struct vt *t, int y, int x)
+{
+	t->y = clamp(y, 0, t->rows - 1);
+	t->x = clamp(x, 0, t->cols - 1);
+	t->wrap_pending = 0;
+}
+
+static void line_feed(struct vt *t)
+{
+	if (t->y == t->bottom)
+		scroll_up(t, t->top, t->bottom, 1);
+	else if (t->y < t->rows - 1)
+		t->y++;
+	t->wrap_pending = 0;
+}
+
+static void reverse_index(struct vt *t)
+{
+	if (t->y == t->top)
+		scroll_down(t, t->top, t->bottom, 1);
+	else if (t->y > 0)
+		t->y--;
+	t->wrap_pending = 0;
+}
+
+static void put(struct vt *t, unsigned c)
+{
+	if (t->wrap_pending) {
+		t->x = 0;
+		line_feed(t);
+	}
+	t->cell[t->y][t->x] = c;
+	t->last = c;
+	if (t->x == t->cols - 1)
+		t->wrap_pending = 1;
+	else
+		t->x++;
+}
+
+void vt_init(struct vt *t, int rows, int cols)
+{
+	memset(t, 0, sizeof *t);
+	t->rows = clamp(rows, 1, VT_MAX_ROWS);
+	t->cols = clamp(cols, 1, VT_MAX_COLS);
+	t->bottom = t->rows - 1;
+	blank_rows(t, 0, VT_MAX_ROWS);
+}
+
+void vt_resize(struct vt *t, int rows, int cols)
+{
+	int y;
+
+	rows = clamp(rows, 1, VT_MAX_ROWS);
+	cols = clamp(cols, 1, VT_MAX_COLS);
+	for (y = 0; y < VT_MAX_ROWS; y++)	/* what was off the edge */
+		blank(t, y, y < t->rows ? t->cols : 0, VT_MAX_COLS);
+	t->rows = rows;
+	t->cols = cols;
+	t->top = 0;
+	t->bottom = rows - 1;
+	move_to(t, t->y, t->x);
+}
+
+/* the n-th parameter of the CSI sequence, or def when missing or 0 */
+static int param(const struct vt *t, int n, int def)
+{
+	const char *p = t->seq;
+	long v;
+
+	while (*p == '?' || *p == '>' || *p == '=')
+		p++;
+	while (n-- > 0) {
+		if ((p = strchr(p, ';')) == NULL)
+			return def;
+		p++;
+	}
+	v = strtol(p, NULL, 10);
+	return v > 0 ? (int) v : def;
+}
+
+static void erase_display(struct vt *t, int how)
+{
+	switch (how) {
+	case 0:
+		blank(t, t->y, t->x, t->cols);
+		blank_rows(t, t->y + 1, t->rows);
+		break;
+	case 1:
+		blank_rows(t, 0, t->y);
+		blank(t, t->y, 0, t->x + 1);
+		break;
+	default:
+		blank_rows(t, 0, t->rows);
+		break;
+	}
+}
+
+static void erase_line(struct vt *t, int how)
+{
+	if (how == 0)
+		blank(t, t->y, t->x, t->cols);
+	else if (how == 1)
+		blank(t, t->y, 0, t->x + 1);
+	else
+		blank(t, t->y, 0, t->cols);
+}
+
+static void insert_chars(struct vt *t, int n)
+{
+	n = clamp(n, 0, t->cols - t->x);
+	memmove(&t->cell[t->y][t->x + n], &t->cell[t->y][t->x],
+	    (t->cols - t->x - n) * sizeof t->cell[0][0]);
+	blank(t, t->y, t->x, t->x + n);
+}
+
+static void delete_chars(struct vt *t, int n)
+{
+	n = clamp(n, 0, t->cols - t->x);
+	memmove(&t->cell[t->y][t->x], &t->cell[t->y][t->x + n],
+	    (t->cols - t->x - n) * sizeof t->cell[0][0]);
+	blank(t, t->y, t->cols - n, t->cols);
+}
+
+/* modes: only the alternate screen matters, which starts out clear */
+static void set_mode(struct vt *t, int on)
+{
+	if (t->seq[0] == '?' && on && (param(t, 0, 0) == 1049
+	    || param(t, 0, 0) == 47 || param(t, 0, 0) == 1047))
+		blank_rows(t, 0, t->rows);
+}
+
+static void csi(struct vt *t, char final)
+{
+	int n = param(t, 0, 1), i;
+
+	switch (final) {
+	case 'A':
+		move_to(t, t->y - n, t->x);
+		break;
+	case 'B':
+	case 'e':
+		move_to(t, t->y + n, t->x);
+		break;
+	case 'C':
+	case 'a':
+		move_to(t, t->y, t->x + n);
+		break;
+	case 'D':
+		move_to(t, t->y, t->x - n);
+		break;
+	case 'E':
+		move_to(t, t->y + n, 0);
+		break;
+	case 'F':
+		move_to(t, t->y - n, 0);
+		break;
+	case 'G':
+	case '`':
+		move_to(t, t->y, n - 1);
+		break;
+	case 'd':
+		move_to(t, n - 1, t->x);
+		break;
+	case 'H':
+	case 'f':
+		move_to(t, n - 1, param(t, 1, 1) - 1);
+		break;
+	case 'J':
+		erase_display(t, param(t, 0, 0));
+		break;
+	case 'K':
+		erase_line(t, param(t, 0, 0));
+		break;
+	case 'L':
+		if (t->y >= t->top && t->y <= t->bottom)
+			scroll_down(t, t->y, t->bottom, n);
+		t->x = 0;
+		break;
+	case 'M':
+		if (t->y >= t->top && t->y <= t->bottom)
+			scroll_up(t, t->y, t->bottom, n);
+		t->x = 0;
+		break;
+	case '@':
+		insert_chars(t, n);
+		break;
+	case 'P':
+		delete_chars(t, n);
+		break;
+	case 'X':
+		blank(t, t->y, t->x, clamp(t->x + n, 0, t->cols));
+		break;
+	case 'S':
+		scroll_up(t, t->top, t->bottom, n);
+		break;
+	case 'T':
+		scroll_down(t, t->top, t->bottom, n);
+		break;
+	case 'b':
+		for (i = 0; i < n; i++)
+			put(t, t->last);
+		break;
+	case 'r':
+		t->top = clamp(param(t, 0, 1) - 1, 0, t->rows - 1);
+		t->bottom = clamp(param(t, 1, t->rows) - 1, t->top, t->rows - 1);
+		move_to(t, 0, 0);
+		break;
+	case 'h':
+		set_mode(t, 1);
+		break;
+	case 'l':
+		set_mode(t, 0);
+		break;
+	case 'm':	/* attributes */
+	case 't':	/* window operations */
+	case 'n':	/* reports */
+	case 'c':
+		break;
+	default:
+		t->unknown++;
+		break;
+	}
+}
+
+static void escape(struct vt *t, char c)
+{
+	t->state = GROUND;
+	switch (c) {
+	case '[':
+		t->state = CSI;
+		t->seq_len = 0;
+		break;
+	case ']':
+	case 'P':
+	case '_':
+	case '^':
+		t->state = STRING;
+		break;
+	case '(':
+	case ')':
+	case '*':
+	case '+':
+		t->state = CHARSET;
+		break;
+	case '7':
+		t->saved_y = t->y;
+		t->saved_x = t->x;
+		break;
+	case '8':
+		move_to(t, t->saved_y, t->saved_x);
+		break;
+	case 'D':
+		line_feed(t);
+		break;
+	case 'E':
+		t->x = 0;
+		line_feed(t);
+		break;
+	case 'M':
+		reverse_index(t);
+		break;
+	case 'c':
+		vt_init(t, t->rows, t->cols);
+		break;
+	case '=':
+	case '>':
+	case '\\':	/* the end of a string */
+		break;
+	default:
+		t->unknown++;
+		break;
+	}
+}
+
+static void control(struct vt *t, unsigned char c)
+{
+	switch (c) {
+	case '\r':
+		t->x = 0;
+		t->wrap_pending = 0;
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		line_feed(t);
+		break;
+	case '\b':
+		if (t->x > 0)
+			t->x--;
+		t->wrap_pending = 0;
+		break;
+	case '\t':
+		move_to(t, t->y, (t->x / 8 + 1) * 8);
+		break;
+	case 033:
+		t->state = ESCAPE;
+		break;
+	default:	/* bell, shifts and the rest */
+		break;
+	}
+}
+
+void vt_write(struct vt *t, const char *p, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) p;
+
+	for (; len--; s++) {
+		unsigned char c = *s;
+
+		switch (t->state) {
+		case ESCAPE:
+			escape(t, c);
+			continue;
+		case CSI:
+			if (c >= 0x40 && c <= 0x7e) {
+				t->seq[t->seq_len] = '\0';
+				t->state = GROUND;
+				csi(t, c);
+			} else if (c < 0x20) {
+				control(t, c);	/* as xterm does, mid-sequence */
+			} else if (t->seq_len < sizeof t->seq - 1) {
+				t->seq[t->seq_len++] = c;
+			}
+			continue;
+		case STRING:	/* ends with BEL, or ST whose ESC lands here */
+			if (c == 007)
+				t->state = GROUND;
+			else if (c == 033)
+				t->state = ESCAPE;
+			continue;
+		case CHARSET:
+			t->state = GROUND;
+			continue;
+		}
+		if (t->utf8_left && (c & 0xc0) == 0x80) {
+			t->utf8 = t->utf8 << 6 | (c & 0x3f);
+			if (!--t->utf8_left)
+				put(t, t->utf8);
+			continue;
+		}
+		t->utf8_left = 0;
+		if (c < 0x20 || c == 0x7f)
+			control(t, c);
+		else if (c < 0x80)
+			put(t, c);
+		else if ((c & 0xe0) == 0xc0) {
+			t->utf8 = c & 0x1f;
+			t->utf8_left = 1;
+		} else if ((c & 0xf0) == 0xe0) {
+			t->utf8 = c & 0x0f;
+			t->utf8_left = 2;
+		} else if ((c & 0xf8) == 0xf0) {
+			t->utf8 = c & 0x07;
+			t->utf8_left = 3;
+		}
+	}
+}
+
+char *vt_row(const struct vt *t, int y, char *buf, size_t size)
+{
+	size_t n = 0, end = 0;
+	int x;
+
+	for (x = 0; x < t->cols && n + 5 < size; x++) {
+		unsigned c = t->cell[y][x];
+
+		if (c < 0x80)
+			buf[n++] = c;
+		else if (c < 0x800) {
+			buf[n++] = 0xc0 | c >> 6;
+			buf[n++] = 0x80 | (c & 0x3f);
+		} else if (c < 0x10000) {
+			buf[n++] = 0xe0 | c >> 12;
+			buf[n++] = 0x80 | (c >> 6 & 0x3f);
+			buf[n++] = 0x80 | (c & 0x3f);
+		} else {
+			buf[n++] = 0xf0 | c >> 18;
+			buf[n++] = 0x80 | (c >> 12 & 0x3f);
+			buf[n++] = 0x80 | (c >> 6 & 0x3f);
+			buf[n++] = 0x80 | (c & 0x3f);
+		}
+		if (c != ' ')
+			end = n;
+	}
+	buf[end] = '\0';
+	return buf;
+}
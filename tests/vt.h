@@ -0,0 +1,39 @@
+/* vt.h -- a screen model of the terminal watch draws on, for the tests */
+
+#ifndef WATCH_VT_H
+#define WATCH_VT_H
+
+#include <stddef.h>
+
+#define VT_MAX_ROWS 100
+#define VT_MAX_COLS 300
+
+struct vt {
+	int rows, cols;
+	int y, x;		/* the cursor */
+	int wrap_pending;	/* the last column was just written */
+	int top, bottom;	/* the scroll region, rows inclusive */
+	int saved_y, saved_x;
+	unsigned last;		/* the last character written, for REP */
+	unsigned cell[VT_MAX_ROWS][VT_MAX_COLS];	/* code points */
+	/* the escape sequence or UTF-8 character being read */
+	int state;
+	char seq[64];
+	size_t seq_len;
+	unsigned utf8;
+	int utf8_left;
+	unsigned long unknown;	/* sequences it does not know, ignored */
+};
+
+extern void vt_init(struct vt *t, int rows, int cols);
+
+/* the terminal changed size: keep what fits, as xterm does */
+extern void vt_resize(struct vt *t, int rows, int cols);
+
+/* take what was written to the terminal */
+extern void vt_write(struct vt *t, const char *p, size_t len);
+
+/* row y as UTF-8 without trailing blanks; returns buf */
+extern char *vt_row(const struct vt *t, int y, char *buf, size_t size);
+
+#endif
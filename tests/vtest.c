@@ -0,0 +1,453 @@
+/* vtest.c -- regression tests for what watch draws, and how much
+ *
+ * `tests/vtest ./watch` runs watch on a pseudo-terminal in a few
+ * scenarios, a static output, a counter (with and without --history),
+ * a scrolling log and a resize, feeding everything it writes through a
+ * screen model (vt.c) and checking what ends up on the screen.  The bytes each frame took come
+ * from --debug-stats; they are printed for every scenario, and frames
+ * after the first that take more than the scenario's budget fail it, so
+ * that drawing more than it needs to shows up as well as drawing the
+ * wrong thing.  A watch built with -DALLOC_STATS also reports the calls
+ * into the allocator each frame made, and frames after the first
+ * WARM_FRAMES (after the start or a resize) that made any fail too.
+ * `make check` builds and runs it on both.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "vt.h"
+
+#define MAX_FRAMES 1024
+#define WAIT_MSEC 5000		/* for the screen to show what it should */
+#define WARM_FRAMES 10		/* to size the buffers, allocating */
+
+struct term {
+	pid_t pid;
+	int master;		/* -1 once watch has gone */
+	struct vt vt;
+	FILE *stats;		/* --debug-stats, read as it is written */
+	unsigned long frames;
+	unsigned long long bytes[MAX_FRAMES];
+	int counted;		/* the frames report allocs */
+	unsigned long allocs[MAX_FRAMES];
+	unsigned long warm;	/* frames after this one must not allocate */
+};
+
+static const char *watch_path;
+static char dir[] = "/tmp/vtest.XXXXXX";
+static struct term term;	/* the screen is too big for the stack */
+static int failures;
+
+static long long msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void fail(const char *scenario, const char *fmt, ...)
+{
+	char row[4 * VT_MAX_COLS + 1];
+	va_list ap;
+	int y;
+
+	printf("FAIL %s: ", scenario);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\nscreen, %dx%d:\n", term.vt.rows, term.vt.cols);
+	for (y = 0; y < term.vt.rows; y++)
+		printf("  |%s\n", vt_row(&term.vt, y, row, sizeof row));
+	failures++;
+}
+
+static void set_size(int fd, int rows, int cols)
+{
+	struct winsize ws;
+
+	memset(&ws, 0, sizeof ws);
+	ws.ws_row = rows;
+	ws.ws_col = cols;
+	ioctl(fd, TIOCSWINSZ, &ws);
+}
+
+static void path(char *buf, size_t size, const char *name)
+{
+	snprintf(buf, size, "%s/%s", dir, name);
+}
+
+static void write_file(const char *name, const char *text, const char *mode)
+{
+	char p[64];
+	FILE *fp;
+
+	path(p, sizeof p, name);
+	if ((fp = fopen(p, mode)) == NULL || fputs(text, fp) == EOF
+	    || fclose(fp) == EOF) {
+		perror(p);
+		exit(2);
+	}
+}
+
+static void remove_dir(void)
+{
+	static const char *names[] = { "stats", "counter", "log" };
+	char p[64];
+	size_t i;
+
+	for (i = 0; i < sizeof names / sizeof *names; i++) {
+		path(p, sizeof p, names[i]);
+		unlink(p);
+	}
+	rmdir(dir);
+}
+
+/* run watch with opt (or none) on a rows x cols terminal of its own */
+static void start(int rows, int cols, const char *interval,
+    const char *opt, const char *command)
+{
+	char stats[64];
+	const char *slave;
+	int fd, status;
+
+	path(stats, sizeof stats, "stats");
+	unlink(stats);
+	memset(term.bytes, 0, sizeof term.bytes);
+	memset(term.allocs, 0, sizeof term.allocs);
+	term.frames = 0;
+	term.counted = 0;
+	term.warm = WARM_FRAMES;
+	vt_init(&term.vt, rows, cols);
+	if ((term.master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+	    || grantpt(term.master) < 0 || unlockpt(term.master) < 0
+	    || (slave = ptsname(term.master)) == NULL) {
+		perror("posix_openpt");
+		exit(2);
+	}
+	set_size(term.master, rows, cols);
+	fflush(stdout);
+	if ((term.pid = fork()) < 0) {
+		perror("fork");
+		exit(2);
+	}
+	if (term.pid == 0) {
+		char stats_opt[80];
+
+		setsid();	/* the slave becomes the controlling tty */
+		if ((fd = open(slave, O_RDWR)) < 0)
+			_exit(127);
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		if (fd > 2)
+			close(fd);
+		close(term.master);
+		setenv("TERM", "xterm", 1);
+		setenv("TZ", "UTC", 1);
+		unsetenv("LINES");	/* or the size never changes */
+		unsetenv("COLUMNS");
+		snprintf(stats_opt, sizeof stats_opt, "--debug-stats=%s", stats);
+		if (opt)
+			execl(watch_path, watch_path, "-n", interval,
+			    stats_opt, opt, command, (char *) NULL);
+		else
+			execl(watch_path, watch_path, "-n", interval,
+			    stats_opt, command, (char *) NULL);
+		_exit(127);
+	}
+	/* there once watch has set up, unless it could not */
+	while ((term.stats = fopen(stats, "r")) == NULL) {
+		if (waitpid(term.pid, &status, WNOHANG) == term.pid) {
+			fprintf(stderr, "%s did not start\n", watch_path);
+			remove_dir();
+			exit(2);
+		}
+		usleep(10000);
+	}
+}
+
+/* the frames --debug-stats has written lines for so far */
+static void read_stats(void)
+{
+	char line[256];
+	unsigned long frame, allocs;
+	unsigned long long bytes, usec;
+	int n;
+
+	while (fgets(line, sizeof line, term.stats)) {
+		if (!strchr(line, '\n')) {	/* the rest is still to come */
+			fseek(term.stats, -(long) strlen(line), SEEK_CUR);
+			break;
+		}
+		n = sscanf(line, "frame %lu bytes %llu usec %llu allocs %lu",
+		    &frame, &bytes, &usec, &allocs);
+		if (n >= 2 && frame >= 1 && frame <= MAX_FRAMES) {
+			term.bytes[frame - 1] = bytes;
+			term.frames = frame;
+			if (n == 4) {
+				term.allocs[frame - 1] = allocs;
+				term.counted = 1;
+			}
+		}
+	}
+	clearerr(term.stats);
+}
+
+/* take what watch wrote for up to timeout msec; 0 once it is gone */
+static int pump(int timeout)
+{
+	struct pollfd pfd;
+	char buf[4096];
+	ssize_t n;
+
+	pfd.fd = term.master;
+	pfd.events = POLLIN;
+	if (term.master >= 0 && poll(&pfd, 1, timeout) > 0) {
+		if ((n = read(term.master, buf, sizeof buf)) > 0)
+			vt_write(&term.vt, buf, n);
+		else if (n < 0 && errno != EINTR && errno != EAGAIN) {
+			close(term.master);	/* EIO: the slave is closed */
+			term.master = -1;
+		}
+	}
+	read_stats();
+	return term.master >= 0;
+}
+
+/* whether row y shows text (at its start, with exact 0) within WAIT_MSEC */
+static int wait_row(int y, const char *text, int exact)
+{
+	char row[4 * VT_MAX_COLS + 1];
+	long long until = msec() + WAIT_MSEC;
+
+	do {
+		vt_row(&term.vt, y, row, sizeof row);
+		if (exact ? !strcmp(row, text) : strstr(row, text) != NULL)
+			return 1;
+	} while (pump(50) && msec() < until);
+	return 0;
+}
+
+static int wait_frames(unsigned long frames)
+{
+	long long until = msec() + WAIT_MSEC;
+
+	while (term.frames < frames && pump(50) && msec() < until)
+		;
+	return term.frames >= frames;
+}
+
+/* let the screen settle: no bytes and no frames for msec */
+static void settle(int quiet)
+{
+	unsigned long frames;
+	long long until = msec() + WAIT_MSEC;
+
+	do {
+		frames = term.frames;
+		pump(quiet);
+	} while (term.frames != frames && msec() < until);
+}
+
+static void check_row(const char *scenario, int y, const char *text)
+{
+	if (!wait_row(y, text, 1))
+		fail(scenario, "expected row %d to read \"%s\"", y, text);
+}
+
+/* the header: the interval on the left, the date right up to the edge,
+ * which after a resize is only there once it has been drawn again */
+static void check_header(const char *scenario, const char *interval)
+{
+	char row[4 * VT_MAX_COLS + 1], every[32];
+	long long until = msec() + WAIT_MSEC;
+
+	snprintf(every, sizeof every, "Every %s", interval);
+	do {
+		vt_row(&term.vt, 0, row, sizeof row);
+		if (!strncmp(row, every, strlen(every))
+		    && (int) strlen(row) == term.vt.cols)
+			break;
+	} while (pump(50) && msec() < until);
+	if (strncmp(row, every, strlen(every)))
+		fail(scenario, "expected a header with \"%s\"", every);
+	else if ((int) strlen(row) != term.vt.cols)
+		fail(scenario, "expected the header to reach column %d",
+		    term.vt.cols);
+	if (term.vt.unknown)
+		fail(scenario, "%lu escape sequences the screen model does not know",
+		    term.vt.unknown);
+}
+
+/* the terminal is now rows x cols, and watch sizes its buffers again */
+static void resize_to(int rows, int cols)
+{
+	read_stats();
+	term.warm = term.frames + WARM_FRAMES;
+	vt_resize(&term.vt, rows, cols);
+	set_size(term.master, rows, cols);
+}
+
+/* stop watch, print the bytes of its frames and hold the frames after
+ * the first to budget (0 for none), and those after the warm-up to no
+ * allocations where they are counted */
+static void stop(const char *scenario, unsigned long long budget)
+{
+	unsigned long long total = 0, max = 0;
+	unsigned long i, allocating = 0;
+	int status;
+
+	kill(term.pid, SIGTERM);
+	while (pump(100))
+		;
+	waitpid(term.pid, &status, 0);
+	read_stats();
+	fclose(term.stats);
+	printf("%-8s %3lu frames, bytes:", scenario, term.frames);
+	for (i = 0; i < term.frames; i++) {
+		printf(" %llu", term.bytes[i]);
+		if (i) {
+			total += term.bytes[i];
+			if (term.bytes[i] > max)
+				max = term.bytes[i];
+		}
+	}
+	printf("\n%-8s first %llu, then %.1f a frame, %llu at most",
+	    "", term.frames ? term.bytes[0] : 0,
+	    term.frames > 1 ? (double) total / (term.frames - 1) : 0.0, max);
+	if (budget)
+		printf(" (budget %llu)", budget);
+	printf("\n");
+	if (!term.frames)
+		fail(scenario, "expected frames in --debug-stats");
+	if (budget && max > budget)
+		fail(scenario, "a frame went over its budget");
+	if (!term.counted)
+		return;
+	printf("%-8s allocs:", "");
+	for (i = 0; i < term.frames; i++) {
+		printf(" %lu", term.allocs[i]);
+		if (i >= term.warm && term.allocs[i] && !allocating)
+			allocating = i + 1;
+	}
+	printf("\n");
+	if (term.frames <= term.warm)
+		fail(scenario, "expected frames after the %lu of the warm-up",
+		    term.warm);
+	if (allocating)
+		fail(scenario, "frame %lu allocated after the warm-up",
+		    allocating);
+}
+
+/* the same output run after run: after the first frame only the clock */
+static void static_output(void)
+{
+	start(12, 60, "0.1", NULL, "echo hello; echo world");
+	check_header("static", "0.1s");
+	check_row("static", 2, "hello");
+	check_row("static", 3, "world");
+	check_row("static", 4, "");
+	if (!wait_frames(20))
+		fail("static", "expected 20 frames");
+	stop("static", 64);
+}
+
+/* one number changing in place, with opt (or none) */
+static void counter(const char *scenario, const char *opt)
+{
+	char cmd[64], n[16];
+	int i;
+
+	snprintf(cmd, sizeof cmd, "cat %s/counter", dir);
+	write_file("counter", "0\n", "w");
+	start(12, 60, "0.1", opt, cmd);
+	check_header(scenario, "0.1s");
+	for (i = 1; i <= 20; i++) {
+		snprintf(n, sizeof n, "%d\n", i * 7);
+		write_file("counter", n, "w");
+		n[strlen(n) - 1] = '\0';
+		check_row(scenario, 2, n);
+	}
+	settle(300);
+	stop(scenario, 64);
+}
+
+/* a log growing a line at a time, its tail on the screen: lines move
+ * up, which the terminal can do itself */
+static void scroll(void)
+{
+	char cmd[80], line[32];
+	int i, y;
+
+	snprintf(cmd, sizeof cmd, "tail -n 10 %s/log", dir);
+	write_file("log", "", "w");
+	start(12, 60, "0.1", NULL, cmd);
+	check_header("scroll", "0.1s");
+	for (i = 1; i <= 30; i++) {
+		snprintf(line, sizeof line, "log line %d of the run\n", i);
+		write_file("log", line, "a");
+		line[strlen(line) - 1] = '\0';
+		check_row("scroll", i < 10 ? i + 1 : 11, line);
+	}
+	for (y = 2; y < 12; y++) {
+		snprintf(line, sizeof line, "log line %d of the run", 19 + y);
+		check_row("scroll", y, line);
+	}
+	settle(300);
+	stop("scroll", 96);
+}
+
+/* the terminal grows and shrinks: the output is laid out again */
+static void resize(void)
+{
+	start(12, 60, "0.1", NULL, "echo hello; seq 1 30");
+	check_header("resize", "0.1s");
+	check_row("resize", 2, "hello");
+	check_row("resize", 11, "9");
+	resize_to(20, 80);
+	check_header("resize", "0.1s");
+	check_row("resize", 19, "17");
+	resize_to(10, 50);
+	check_header("resize", "0.1s");
+	check_row("resize", 9, "7");
+	check_row("resize", 2, "hello");
+	wait_frames(term.warm + 5);	/* for stop() to hold to none */
+	stop("resize", 0);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <watch>\n", argv[0]);
+		return 2;
+	}
+	watch_path = argv[1];
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 2;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	static_output();
+	counter("counter", NULL);
+	counter("history", "--history=5");
+	scroll();
+	resize();
+	remove_dir();
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+}
@@ -0,0 +1,304 @@
+/* uring.c -- an io_uring in place of poll() for watch's event loop
+ *
+ * With poll() every run costs a poll, a read that returns the output and
+ * another that returns EAGAIN, then a waitpid every few milliseconds
+ * until the child has exited.  Here one io_uring_enter() per wakeup
+ * submits everything and waits for the first completion: the child's
+ * output is read by a POLL_ADD linked to a READ straight into libwatch's
+ * capture buffer, its exit arrives as a poll on a pidfd, and the tick is
+ * a TIMEOUT that also ends when anything else completes.
+ *
+ * The ring is driven with the raw system calls, so watch does not need
+ * liburing.  Anything the kernel does not support sends watch back to
+ * poll() (no ring) or to polling waitpid (no pidfd).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES	16
+#define URING_POLLS	4	/* fds other than the watch fd */
+
+/* user_data of each kind of request; polls on pfd fds add the fd */
+enum { TAG_TIMEOUT = 1, TAG_READ_POLL, TAG_READ, TAG_CHILD, TAG_POLL };
+
+struct uring {
+	int fd;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	int polling[URING_POLLS];	/* fds with a POLL_ADD in flight */
+	int reading;		/* READ on the watch fd in flight */
+	int pidfd;		/* pidfd of the child being reaped, or -1 */
+	pid_t pidfd_child;
+	int no_pidfd;		/* pidfds unsupported; poll waitpid instead */
+	struct __kernel_timespec ts;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+	    NULL, _NSIG / 8);
+}
+
+struct uring *uring_open(void)
+{
+	struct io_uring_params p;
+	struct uring *u;
+	unsigned char *sq, *cq;
+	int i;
+
+	if ((u = calloc(1, sizeof *u)) == NULL)
+		return NULL;
+	memset(&p, 0, sizeof p);
+	if ((u->fd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0) {
+		free(u);
+		return NULL;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+		goto fail_ring;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else {
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED)
+			goto fail_sq;
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto fail_cq;
+
+	sq = u->sq_ring;
+	u->sq_head = (unsigned *) (sq + p.sq_off.head);
+	u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *) (sq + p.sq_off.array);
+	cq = u->cq_ring;
+	u->cq_head = (unsigned *) (cq + p.cq_off.head);
+	u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+	for (i = 0; i < URING_POLLS; i++)
+		u->polling[i] = -1;
+	u->pidfd = -1;
+	return u;
+
+fail_cq:
+	if (u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+fail_sq:
+	munmap(u->sq_ring, u->sq_ring_size);
+fail_ring:
+	close(u->fd);
+	free(u);
+	return NULL;
+}
+
+/* the next free submission entry, cleared; the ring is sized so that the
+ * few requests watch has in flight always fit */
+static struct io_uring_sqe *get_sqe(struct uring *u, int op, int fd,
+    unsigned long long tag)
+{
+	unsigned tail = *u->sq_tail, index = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->user_data = tag;
+	u->sq_array[index] = index;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+static int start_poll(struct uring *u, int fd)
+{
+	int i, free_slot = -1;
+
+	for (i = 0; i < URING_POLLS; i++) {
+		if (u->polling[i] == fd)
+			return 0;
+		if (u->polling[i] < 0 && free_slot < 0)
+			free_slot = i;
+	}
+	if (free_slot < 0)
+		return -1;
+	u->polling[free_slot] = fd;
+	get_sqe(u, IORING_OP_POLL_ADD, fd, TAG_POLL + fd)->poll32_events = POLLIN;
+	return 0;
+}
+
+static void poll_done(struct uring *u, int fd, int res,
+    struct pollfd *pfd, int nfds)
+{
+	int i;
+
+	for (i = 0; i < URING_POLLS; i++)
+		if (u->polling[i] == fd)
+			u->polling[i] = -1;
+	for (i = 0; i < nfds; i++)
+		if (pfd[i].fd == fd && res > 0)
+			pfd[i].revents = res;
+}
+
+static int start_read(struct uring *u, struct watch_ctx *w)
+{
+	struct io_uring_sqe *sqe;
+	size_t len;
+	char *buf;
+
+	if ((buf = watch_read_buffer(w, &len)) == NULL)
+		return -1;
+	/* the pipe is non-blocking, so wait for it to be readable first */
+	sqe = get_sqe(u, IORING_OP_POLL_ADD, w->fd, TAG_READ_POLL);
+	sqe->poll32_events = POLLIN;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe = get_sqe(u, IORING_OP_READ, w->fd, TAG_READ);
+	sqe->addr = (unsigned long) buf;
+	sqe->len = len;
+	sqe->off = (unsigned long long) -1;
+	u->reading = 1;
+	return 0;
+}
+
+static void start_child(struct uring *u, pid_t child)
+{
+#ifdef __NR_pidfd_open
+	if (u->pidfd >= 0 && u->pidfd_child == child)
+		return;
+	if ((u->pidfd = syscall(__NR_pidfd_open, child, 0)) >= 0) {
+		u->pidfd_child = child;
+		get_sqe(u, IORING_OP_POLL_ADD, u->pidfd, TAG_CHILD)->poll32_events = POLLIN;
+		return;
+	}
+#endif
+	u->no_pidfd = 1;
+}
+
+int uring_wait(struct uring *u, struct watch_ctx *w,
+    struct pollfd *pfd, int nfds, long long timeout)
+{
+	unsigned head, tail, to_submit;
+	int i, r, events = 0, child_exited = 0;
+
+	for (i = 0; i < nfds; i++) {
+		pfd[i].revents = 0;
+		start_poll(u, pfd[i].fd);
+	}
+	if (w->state == WATCH_READING && !u->reading && start_read(u, w) < 0)
+		return -1;
+	if (w->state == WATCH_REAPING) {
+		if (!u->no_pidfd)
+			start_child(u, w->child);
+		/* without a pidfd, poll waitpid as watch_step() would */
+		if (u->pidfd < 0 && (timeout < 0 || timeout > (long long) w->reap_delay))
+			timeout = w->reap_delay;
+	}
+	if (timeout > 0) {
+		struct io_uring_sqe *sqe;
+
+		u->ts.tv_sec = timeout / USECS_PER_SEC;
+		u->ts.tv_nsec = timeout % USECS_PER_SEC * 1000;
+		sqe = get_sqe(u, IORING_OP_TIMEOUT, -1, TAG_TIMEOUT);
+		sqe->addr = (unsigned long) &u->ts;
+		sqe->len = 1;
+		sqe->off = 1;	/* or as soon as anything else completes */
+	}
+
+	to_submit = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (sys_io_uring_enter(u->fd, to_submit, timeout != 0,
+	    IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+		w->errfunc = "io_uring_enter";
+		w->errcode = 1;
+		return -1;
+	}
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		int res = cqe->res;
+
+		switch (cqe->user_data) {
+		case TAG_TIMEOUT:
+		case TAG_READ_POLL:	/* the READ linked to it reports */
+			break;
+		case TAG_READ:
+			u->reading = 0;
+			if (res == -ECANCELED)
+				break;
+			if ((r = watch_read_done(w, res)) < 0) {
+				__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+				return -1;
+			}
+			events |= r;
+			break;
+		case TAG_CHILD:
+			close(u->pidfd);
+			u->pidfd = -1;
+			child_exited = 1;
+			break;
+		default:
+			poll_done(u, cqe->user_data - TAG_POLL, res, pfd, nfds);
+			break;
+		}
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+	if (w->state == WATCH_REAPING && (child_exited || u->no_pidfd)) {
+		if ((r = watch_step(w)) < 0)
+			return -1;
+		events |= r;
+	}
+	return events;
+}
+
+#else
+
+struct uring *uring_open(void)
+{
+	return NULL;
+}
+
+int uring_wait(struct uring *u, struct watch_ctx *w,
+    struct pollfd *pfd, int nfds, long long timeout)
+{
+	return 0;
+}
+
+#endif
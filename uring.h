@@ -0,0 +1,22 @@
+#ifndef WATCH_URING_H
+#define WATCH_URING_H
+
+#include <poll.h>
+#include "libwatch.h"
+
+struct uring;
+
+/* set up an io_uring for the event loop; NULL when the system has none,
+ * and the caller keeps using poll() */
+extern struct uring *uring_open(void);
+
+/* wait like poll() for the fds in pfd, at most timeout usec (-1 for no
+ * limit), with the watch fd left out: while w is reading, its output is
+ * read straight into the capture buffer, and while it is reaping, the
+ * child's exit is waited for too, so timeout need not cover that.
+ * Returns the WATCH_* events of the runs that finished, or -1 with
+ * errfunc and errcode set. */
+extern int uring_wait(struct uring *u, struct watch_ctx *w,
+    struct pollfd *pfd, int nfds, long long timeout);
+
+#endif
@@ -35,17 +35,65 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <termios.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include "procps.h"
+#include "selfbench.h"
+#include "simulate.h"
+#include "libwatch.h"
+#include "control.h"
+#include "uring.h"
+#include "render.h"
+#include "state.h"
+#include "history.h"
+#include "baseline.h"
+#include "record.h"
+#include "soak.h"
 #include <errno.h>
 
-#ifdef FORCE_8BIT
-#undef isprint
-#define isprint(x) ( (x>=' '&&x<='~') || (x>=0xa0) )
-#endif
+/* long options without a short equivalent */
+enum {
+	SELF_BENCHMARK_OPTION = CHAR_MAX + 1,
+	DEBUG_STATS_OPTION,
+	SIMULATE_OPTION,
+	CONTROL_OPTION,
+	UNFOCUSED_OPTION,
+	TMUX_VISIBILITY_OPTION,
+	POWER_SAVE_OPTION,
+	BACKEND_OPTION,
+	THREADS_OPTION,
+	STATE_OPTION,
+	HISTORY_OPTION,
+	NICE_OPTION,
+	IONICE_OPTION,
+	SCHED_OPTION,
+	CPUS_OPTION,
+	SELF_NICE_OPTION,
+	SELF_IONICE_OPTION,
+	SELF_SCHED_OPTION,
+	SELF_CPUS_OPTION,
+	EACH_OPTION,
+	JOBS_OPTION,
+	BASELINE_OPTION,
+	ONCE_OPTION,
+	RECORD_OPTION,
+	EXPORT_OPTION,
+	TAIL_OPTION,
+	TIMELINE_OPTION,
+	GUARD_OPTION,
+	GUARD_STAT_OPTION,
+	GUARD_MAX_AGE_OPTION,
+	BUDGET_OPTION,
+	BUDGET_CLASS_OPTION,
+	BUDGET_STATS_OPTION
+};
 
 static struct option longopts[] = {
   {"color", no_argument, 0, 'c' },
@@ -58,23 +106,67 @@ static struct option longopts[] = {
 	{"precise", no_argument, 0, 'p'},
 	{"no-title", no_argument, 0, 't'},
 	{"version", no_argument, 0, 'v'},
+	{"self-benchmark", required_argument, 0, SELF_BENCHMARK_OPTION},
+	{"debug-stats", required_argument, 0, DEBUG_STATS_OPTION},
+	{"simulate", required_argument, 0, SIMULATE_OPTION},
+	{"control", required_argument, 0, CONTROL_OPTION},
+	{"unfocused", required_argument, 0, UNFOCUSED_OPTION},
+	{"tmux-visibility", no_argument, 0, TMUX_VISIBILITY_OPTION},
+	{"power-save", no_argument, 0, POWER_SAVE_OPTION},
+	{"backend", required_argument, 0, BACKEND_OPTION},
+	{"threads", required_argument, 0, THREADS_OPTION},
+	{"state", required_argument, 0, STATE_OPTION},
+	{"history", required_argument, 0, HISTORY_OPTION},
+	{"nice", required_argument, 0, NICE_OPTION},
+	{"ionice", required_argument, 0, IONICE_OPTION},
+	{"sched", required_argument, 0, SCHED_OPTION},
+	{"cpus", required_argument, 0, CPUS_OPTION},
+	{"self-nice", required_argument, 0, SELF_NICE_OPTION},
+	{"self-ionice", required_argument, 0, SELF_IONICE_OPTION},
+	{"self-sched", required_argument, 0, SELF_SCHED_OPTION},
+	{"self-cpus", required_argument, 0, SELF_CPUS_OPTION},
+	{"each", required_argument, 0, EACH_OPTION},
+	{"jobs", required_argument, 0, JOBS_OPTION},
+	{"baseline", required_argument, 0, BASELINE_OPTION},
+	{"once", optional_argument, 0, ONCE_OPTION},
+	{"record", required_argument, 0, RECORD_OPTION},
+	{"export", required_argument, 0, EXPORT_OPTION},
+	{"tail", no_argument, 0, TAIL_OPTION},
+	{"timeline", no_argument, 0, TIMELINE_OPTION},
+	{"guard", required_argument, 0, GUARD_OPTION},
+	{"guard-stat", required_argument, 0, GUARD_STAT_OPTION},
+	{"guard-max-age", required_argument, 0, GUARD_MAX_AGE_OPTION},
+	{"budget", required_argument, 0, BUDGET_OPTION},
+	{"budget-class", required_argument, 0, BUDGET_CLASS_OPTION},
+	{"budget-stats", no_argument, 0, BUDGET_STATS_OPTION},
 	{0, 0, 0, 0}
 };
 
 static char usage[] =
-    "Usage: %s [-bcdhnptvx] [--beep] [--color] [--differences[=cumulative]] [--exec] [--help] [--interval=<n>] [--no-title] [--version] <command>\n";
+    "Usage: %s [-bcdhnptvx] [--beep] [--color] [--differences[=cumulative]] [--exec] [--help] [--interval=<n>] [--no-title] [--version] [--debug-stats=<file>] [--simulate=<script>[,<runs>]] [--control=<fifo>] [--unfocused=<n>|pause] [--tmux-visibility] [--power-save] [--backend=poll|io_uring] [--threads=<n>] [--state=<file>] [--history=<n>] [--[self-]nice=<n>] [--[self-]ionice=<class>[:<level>]] [--[self-]sched=other|batch|idle] [--[self-]cpus=<list>] [--each=<list>|@<file>] [--jobs=<n>] [--baseline=<file>] [--tail] [--timeline] [--guard=<command>] [--guard-stat=<path>]... [--guard-max-age=<n>] [--budget=<rate>[,<burst>]] [--budget-class=<name>] [--once[=plain|ansi]] [--record=<file>] <command>\n"
+    "       %s --self-benchmark=spawn[:<iterations>] [-x] [<command>]\n"
+    "       %s --self-benchmark=soak[:<ticks>] [<options>] <command>\n"
+    "       %s --export=cast|raw[,<timing>] <recording>\n"
+    "       %s --budget-stats [--budget-class=<name>]\n";
 
 static char *progname;
 
 static int curses_started = 0;
 static int height = 24, width = 80;
 static int screen_size_changed = 0;
-static int first_screen = 1;
-static int show_title = 2;  // number of lines used, 2 or 0
-static int precise_timekeeping = 0;
-
-#define min(x,y) ((x) > (y) ? (y) : (x))
-#define MAX_ANSIBUF 10
+static int simulating = 0;
+static int option_beep = 0;
+static int option_errexit = 0;
+static int focus_reporting = 0;
+static int read_keys = 0;	/* stdin is the terminal */
+static const char *baseline_path;
+static int once_mode = 0;	/* 1 plain, 2 with ANSI escapes */
+static int render_threaded = 0;
+static int draw_colors = 0;	/* curses has the ANSI colors set up */
+static double budget_rate = 0;	/* runs a second, 0 for no --budget */
+static int budget_burst = 1;
+static const char *budget_class = "default";
+static int budget_stats = 0;
 
 static void init_ansi_colors(void)
 {
@@ -87,74 +179,244 @@ static void init_ansi_colors(void)
     init_pair(i+1, ncurses_colors[i], -1);
 }
 
-static void set_ansi_attribute(const int attrib)
+/* --debug-stats: curses writes into a pipe on fd 1 and a relay thread
+ * copies it to the real terminal, counting bytes on the way, so the
+ * terminal traffic of each frame can be recorded. */
+static FILE *stats_fp;
+static int term_fd = -1;	/* the real stdout while the relay runs */
+static int relay_fd[2];
+static pthread_t relay_thread;
+static pthread_mutex_t relay_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long relayed_bytes;
+static unsigned long stats_frames;
+static unsigned long long stats_bytes, stats_max_bytes;
+static unsigned long stats_wakeups;
+static watch_usec_t stats_first_wakeup, stats_last_wakeup;
+static watch_usec_t stats_startup;	/* when main() was entered */
+
+static void *relay_output(void *notused)
 {
-  switch (attrib)
-  {
-    case -1:
-      return;
-    case 0:
-      standend();
-      return;
-    case 1:
-      attrset(A_BOLD);
-      return;
-  }
-  if (attrib >= 30 && attrib <= 37) {
-    color_set(attrib-29,NULL);
-    return;
-  }
+	char buf[4096];
+	struct pollfd pfd;
+
+	(void) notused;
+	pfd.fd = relay_fd[0];
+	pfd.events = POLLIN;
+	for (;;) {
+		ssize_t n, off;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		/* bytes only leave the pipe under the lock, so that
+		 * term_output_bytes() never sees them in neither place */
+		pthread_mutex_lock(&relay_lock);
+		n = read(relay_fd[0], buf, sizeof buf);
+		if (n > 0)
+			relayed_bytes += n;
+		pthread_mutex_unlock(&relay_lock);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		for (off = 0; off < n; ) {
+			ssize_t w = write(term_fd, buf + off, n - off);
+			if (w < 0 && errno != EINTR)
+				return NULL;
+			if (w > 0)
+				off += w;
+		}
+	}
+	return NULL;
 }
 
-static void process_ansi(FILE *fp)
+static void start_relay(void)
 {
-  int i,c, num1, num2;
-  char buf[MAX_ANSIBUF];
-  char *nextnum;
+	if (pipe(relay_fd) < 0) {
+		perror("pipe");
+		exit(7);
+	}
+	fflush(stdout);
+	term_fd = dup(1);
+	if (term_fd < 0 || dup2(relay_fd[1], 1) < 0) {
+		perror("dup2");
+		exit(3);
+	}
+	close(relay_fd[1]);
+	/* the pipe is not a tty, so curses sets the modes on stderr */
+	if (pthread_create(&relay_thread, NULL, relay_output, NULL)) {
+		fputs("cannot start output relay thread\n", stderr);
+		exit(1);
+	}
+}
 
+/* total bytes curses has written to the terminal so far */
+static unsigned long long term_output_bytes(void)
+{
+	unsigned long long total;
+	int pending = 0;
 
-  c= getc(fp);
-  if (c != '[') {
-    ungetc(c, fp);
-    return;
-  }
-  for(i=0; i<MAX_ANSIBUF; i++)
-  {
-    c = getc(fp);
-    if (c == 'm') //COLOUR SEQUENCE ENDS in 'm'
-    {
-      buf[i] = '\0';
-      break;
-    }
-    if (c < '0' && c > '9' && c != ';')
-    {
-      while(--i >= 0)
-        ungetc(buf[i],fp);
-      return;
-    }
-    buf[i] = (char)c;
-  }
-  num1 = strtol(buf, &nextnum, 10);
-  if (nextnum != buf && nextnum[0] != '\0')
-    num2 = strtol(nextnum+1, NULL, 10);
-  else
-    num2 = -1;
-  set_ansi_attribute(num1);
-  set_ansi_attribute(num2);
+	pthread_mutex_lock(&relay_lock);
+	ioctl(relay_fd[0], FIONREAD, &pending);
+	total = relayed_bytes + pending;
+	pthread_mutex_unlock(&relay_lock);
+	return total;
+}
+
+#ifdef ALLOC_STATS
+/* make CFLAGS=-DALLOC_STATS builds a watch that counts its calls into
+ * the allocator (glibc only), and --debug-stats then shows how many
+ * each frame made: none, once the first few frames have sized the
+ * buffers, which make check holds it to (tests/watch-allocs) */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+static unsigned long allocs;
+
+void *malloc(size_t size)
+{
+	__atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static void stats_frame(watch_usec_t elapsed)
+{
+	static unsigned long long last_total;
+	unsigned long long total = term_output_bytes();
+	unsigned long long bytes = total - last_total;
+
+	last_total = total;
+	stats_frames++;
+	stats_bytes += bytes;
+	if (bytes > stats_max_bytes)
+		stats_max_bytes = bytes;
+#ifdef ALLOC_STATS
+	{
+		static unsigned long last_allocs;
+		unsigned long now = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+		fprintf(stats_fp, "frame %lu bytes %llu usec %llu allocs %lu\n",
+		    stats_frames, bytes, elapsed, now - last_allocs);
+		last_allocs = now;
+	}
+#else
+	fprintf(stats_fp, "frame %lu bytes %llu usec %llu\n",
+	    stats_frames, bytes, elapsed);
+#endif
+	if (stats_frames == 1)
+		fprintf(stats_fp, "first frame usec %llu\n",
+		    watch_time_usec() - stats_startup);
+	fflush(stats_fp);
+}
+
+/* with the render thread, frames are counted there once drawn */
+static void stats_drawn(watch_usec_t run_start)
+{
+	stats_frame(watch_time_usec() - run_start);
+}
+
+/* watch is about to sleep until now + something; count the wakeup */
+static void stats_wakeup(watch_usec_t now)
+{
+	if (!stats_wakeups++)
+		stats_first_wakeup = now;
+	stats_last_wakeup = now;
+}
+
+static void stop_stats(void)
+{
+	double minutes = (stats_last_wakeup - stats_first_wakeup) / (60.0 * USECS_PER_SEC);
+
+	if (term_fd >= 0) {
+		/* dropping the last write end lets the relay drain and finish */
+		fflush(stdout);
+		dup2(term_fd, 1);
+		pthread_join(relay_thread, NULL);
+		term_fd = -1;
+	}
+	fprintf(stats_fp, "total frames %lu bytes %llu avg %.1f max %llu\n",
+	    stats_frames, stats_bytes,
+	    stats_frames ? (double) stats_bytes / stats_frames : 0.0,
+	    stats_max_bytes);
+	fprintf(stats_fp, "total wakeups %lu per-minute %.1f\n", stats_wakeups,
+	    minutes > 0 ? stats_wakeups / minutes : 0.0);
+	fclose(stats_fp);
+	stats_fp = NULL;
 }
 
 static void do_usage(void) NORETURN;
 static void do_usage(void)
 {
-	fprintf(stderr, usage, progname);
+	fprintf(stderr, usage, progname, progname, progname, progname, progname);
 	exit(1);
 }
 
+static void sched_option(struct watch_sched *s, int what, const char *arg)
+{
+	if (watch_sched_parse(s, what, arg) < 0)
+		do_usage();
+}
+
+/* --each: targets separated by commas, or one per line of a file */
+static void each_option(struct watch_options *opt, const char *arg)
+{
+	char *list, *target, *save;
+	FILE *fp = NULL;
+	char line[4096];
+
+	if (*arg == '@' && (fp = fopen(arg + 1, "r")) == NULL) {
+		perror(arg + 1);
+		exit(1);
+	}
+	list = fp ? NULL : strdup(arg);
+	for (;;) {
+		if (fp) {
+			if (!fgets(line, sizeof line, fp))
+				break;
+			line[strcspn(line, "\r\n")] = '\0';
+			if (!*line)
+				continue;
+			target = strdup(line);
+		} else if ((target = strtok_r(list, ",", &save)) == NULL)
+			break;
+		list = NULL;
+		opt->each = realloc(opt->each, (opt->each_count + 1) * sizeof *opt->each);
+		if (!opt->each || !target) {
+			perror("malloc");
+			exit(1);
+		}
+		opt->each[opt->each_count++] = target;
+	}
+	if (fp)
+		fclose(fp);
+	if (!opt->each_count)
+		do_usage();
+}
+
 static void do_exit(int status) NORETURN;
 static void do_exit(int status)
 {
-	if (curses_started)
+	if (curses_started) {
+		render_stop();
+		if (focus_reporting)
+			putp("\033[?1004l");
 		endwin();
+	}
+	if (stats_fp)
+		stop_stats();
 	exit(status);
 }
 
@@ -224,39 +486,168 @@ get_terminal_size(void)
 	}
 }
 
-/* get current time in usec */
-typedef unsigned long long watch_usec_t;
-#define USECS_PER_SEC (1000000ull)
-watch_usec_t get_time_usec() {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	return USECS_PER_SEC*now.tv_sec + now.tv_usec;
+/* the clock the schedule runs on under --simulate: a virtual clock
+ * starting at the epoch that only moves when the scripted command runs or
+ * watch sleeps, so a simulation is deterministic and runs as fast as the
+ * CPU allows */
+static watch_usec_t virtual_now;
+
+static watch_usec_t virtual_clock(void *notused)
+{
+	(void) notused;
+	return virtual_now;
+}
+
+/* --unfocused: the terminal reports focus changes as ESC [ I and ESC [ O
+ * on our input once DECSET 1004 is on; everything else typed is ignored */
+static int terminal_focused = 1;
+static int tmux_visible = 1;
+static int tmux_visibility = 0;
+/* while the pane shows, ask tmux no more often than this: each time is a
+ * shell and a tmux client, and the loop waits for them */
+#define TMUX_CHECK_USEC (5 * USECS_PER_SEC)
+
+static void read_input(struct watch_ctx *w)
+{
+	static int state;	/* 0, after ESC, after ESC [ */
+	unsigned char buf[64];
+	ssize_t i, n = read(0, buf, sizeof buf);
+
+	if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+		read_keys = 0;	/* it stays readable, so stop polling it */
+
+	for (i = 0; i < n; i++) {
+		if (state == 0 && buf[i] == 'B')
+			baseline_pin(w);
+		if (state == 2 && (buf[i] == 'I' || buf[i] == 'O')) {
+			terminal_focused = buf[i] == 'I';
+			watch_set_focus(w, terminal_focused && tmux_visible);
+		}
+		if (buf[i] == '\033')
+			state = 1;
+		else if (state == 1 && buf[i] == '[')
+			state = 2;
+		else
+			state = 0;
+	}
+}
+
+/* --tmux-visibility: whether our pane is in the active window of an
+ * attached session; when tmux cannot say, assume it is */
+static int tmux_pane_visible(void)
+{
+	const char *pane = getenv("TMUX_PANE");
+	char cmd[128], buf[16];
+	int visible = 1;
+	FILE *fp;
+
+	if (!getenv("TMUX") || !pane || strspn(pane, "%0123456789") != strlen(pane))
+		return 1;
+	snprintf(cmd, sizeof cmd, "tmux display-message -p -t '%s' "
+	    "'#{window_active}#{session_attached}' 2>/dev/null", pane);
+	if ((fp = popen(cmd, "r")) == NULL)
+		return 1;
+	if (fgets(buf, sizeof buf, fp))
+		visible = buf[0] == '1' && buf[1] != '0';
+	pclose(fp);
+	return visible;
+}
+
+/* a run of the command is on the screen */
+static void run_finished(struct watch_ctx *w, watch_usec_t frame_start)
+{
+	int status = w->status;
+
+	state_save(w);
+	history_add(w);
+	baseline_frame(w);
+	record_frame(w);
+	if (stats_fp && !render_threaded)
+		stats_frame(watch_time_usec() - frame_start);
+
+	/* if child process exited in error, beep if option_beep is set */
+	if ((!WIFEXITED(status) || WEXITSTATUS(status))) {
+          if (option_beep) render_beep();
+          if (option_errexit) do_exit(8);
+	}
+}
+
+/* --self-benchmark=soak: what the main loop does with a frame */
+static void soak_frame(struct watch_ctx *w, watch_usec_t frame_start)
+{
+	run_finished(w, frame_start);
+	if (render_pending())
+		render_retry(w);
+}
+
+/* --simulate: feed the scripted runs through the pipeline, sleeping on
+ * the virtual clock, and trace the schedule and the differences */
+static void simulate(struct watch_ctx *w) NORETURN;
+static void simulate(struct watch_ctx *w)
+{
+	const struct sim_step *step;
+
+	while ((step = sim_next()) != NULL) {
+		watch_usec_t frame_start = watch_time_usec();
+		watch_usec_t run_start = watch_now(w);
+		long long sleep_usec;
+
+		/* the scripted run takes its time up front, as the
+		   output is only complete when the command ends */
+		watch_begin(w);
+		virtual_now += step->duration;
+		if (watch_feed(w, step->output, step->length) < 0) {
+			perror(w->errfunc);
+			do_exit(w->errcode);
+		}
+		watch_end(w, step->status);
+		run_finished(w, frame_start);
+
+		sleep_usec = watch_timeout(w);
+		if (sleep_usec > 0)
+			stats_wakeup(watch_now(w));
+		/* scheduling and diff trace, in virtual usec */
+		fprintf(stats_fp, "run start %llu duration %llu exit %d changed %d sleep %lld\n",
+		    run_start, watch_now(w) - run_start, WEXITSTATUS(step->status),
+		    w->changed, sleep_usec);
+		virtual_now += sleep_usec;
+	}
+	do_exit(0);
 }
 
-// read a wide character from a popen'd stream
-#define MAX_ENC_BYTES 16
-wint_t my_getwc(FILE *s);
-wint_t my_getwc(FILE *s) {
-	char i[MAX_ENC_BYTES]; //assuming no encoding ever consumes more than 16 bytes
-	int byte = 0;
-	int convert;
-	int x;
-	wchar_t rval;
-	while(1) {
-		i[byte] = getc(s);
-		if (i[byte]==EOF) { return WEOF; }
-		byte++;
-		errno = 0;
-		mbtowc(NULL, NULL, 0);
-		convert = mbtowc(&rval, i, byte);
-		x = errno;
-		if(convert > 0) { return rval; } //legal conversion
-		if(byte == MAX_ENC_BYTES) {
-		while(byte > 1) { ungetc(i[--byte], s); } //at least *try* to fix up
-		errno = -EILSEQ;
-		return WEOF;
+/* --once: one run, its frame on stdout and its exit status, without
+ * curses or the terminal */
+static void once(struct watch_ctx *w) NORETURN;
+static void once(struct watch_ctx *w)
+{
+	struct pollfd pfd;
+	int r = 0;
+
+	state_restore(w);	/* --differences against the last frame */
+	while (!(r & WATCH_FRAME)) {
+		long long timeout = watch_timeout(w);
+
+		pfd.fd = watch_fd(w);
+		pfd.events = POLLIN;
+		if (timeout != 0
+		    && poll(&pfd, pfd.fd >= 0, timeout < 0 ? -1 : (int) ((timeout + 999) / 1000)) < 0
+		    && errno != EINTR) {
+			perror("poll");
+			exit(1);
 		}
+		if ((r = watch_step(w)) < 0) {
+			perror(w->errfunc);
+			exit(w->errcode);
+		}
+	}
+	state_save(w);
+	baseline_frame(w);
+	if ((once_mode == 2 ? watch_dump_ansi(w, stdout) : watch_dump(w, stdout)) < 0
+	    || fflush(stdout) == EOF) {
+		perror("stdout");
+		exit(1);
 	}
+	exit(WIFEXITED(w->status) ? WEXITSTATUS(w->status) : 1);
 }
 
 int
@@ -266,26 +657,35 @@ main(int argc, char *argv[])
 	int option_differences = 0,
 	    option_differences_cumulative = 0,
 			option_exec = 0,
-			option_beep = 0,
       option_color = 0,
-        option_errexit = 0,
 	    option_help = 0, option_version = 0;
-	double interval = 2;
+	char *self_benchmark_spec = NULL;
+	unsigned long long soak_ticks = 0;
+	FILE *soak_out = NULL;
+	char *export_spec = NULL;
+	struct watch_options opt;
+	struct watch_ctx *w;
+	struct watch_sink sink;
 	char *command;
-	wchar_t *wcommand = NULL;
 	char **command_argv;
 	int command_length = 0;	/* not including final \0 */
-	int wcommand_columns = 0;	/* not including final \0 */
-	int wcommand_characters = 0; /* not including final \0 */
-    watch_usec_t next_loop; /* next loop time in us, used for precise time
-                               keeping only */
-	int pipefd[2];
-	int status;
-	pid_t child;
+	watch_usec_t frame_start = 0;
+	watch_usec_t tmux_check_at = 0;	/* when hidden, look again then */
+	int control_fd = -1;
+	int option_uring = 0;
+	struct uring *uring = NULL;
+	struct watch_sched self_sched;
 
+	stats_startup = watch_time_usec();
 	setlocale(LC_ALL, "");
 	progname = argv[0];
 
+	memset(&opt, 0, sizeof opt);
+	opt.interval = 2;
+	opt.show_title = 2;  // number of lines used, 2 or 0
+	opt.unfocused_interval = -1;
+	memset(&self_sched, 0, sizeof self_sched);
+
 	while ((optc = getopt_long(argc, argv, "+bced::hn:pvtx", longopts, (int *) 0))
 	       != EOF) {
 		switch (optc) {
@@ -307,7 +707,7 @@ main(int argc, char *argv[])
 			option_help = 1;
 			break;
 		case 't':
-			show_title = 0;
+			opt.show_title = 0;
 			break;
 		case 'x':
 		  option_exec = 1;
@@ -315,21 +715,194 @@ main(int argc, char *argv[])
 		case 'n':
 			{
 				char *str;
-				interval = strtod(optarg, &str);
+				opt.interval = strtod(optarg, &str);
 				if (!*optarg || *str)
 					do_usage();
-				if(interval < 0.1)
-					interval = 0.1;
-				if(interval > ~0u/1000000)
-					interval = ~0u/1000000;
+				if(opt.interval < 0.1)
+					opt.interval = 0.1;
+				if(opt.interval > ~0u/1000000)
+					opt.interval = ~0u/1000000;
 			}
 			break;
 		case 'p':
-			precise_timekeeping = 1;
+			opt.precise = 1;
 			break;
 		case 'v':
 			option_version = 1;
 			break;
+		case SELF_BENCHMARK_OPTION:
+			self_benchmark_spec = optarg;
+			break;
+		case SIMULATE_OPTION:
+			if (sim_load(optarg) < 0)
+				exit(1);
+			simulating = 1;
+			break;
+		case CONTROL_OPTION:
+			if ((control_fd = control_open(optarg)) < 0)
+				exit(1);
+			break;
+		case UNFOCUSED_OPTION:
+			if (!strcmp(optarg, "pause"))
+				opt.unfocused_interval = 0;
+			else {
+				char *str;
+				opt.unfocused_interval = strtod(optarg, &str);
+				if (!*optarg || *str || opt.unfocused_interval < 0)
+					do_usage();
+				if(opt.unfocused_interval < 0.1)
+					opt.unfocused_interval = 0.1;
+				if(opt.unfocused_interval > ~0u/1000000)
+					opt.unfocused_interval = ~0u/1000000;
+			}
+			focus_reporting = 1;
+			break;
+		case TMUX_VISIBILITY_OPTION:
+			tmux_visibility = 1;
+			break;
+		case POWER_SAVE_OPTION:
+			opt.power_save = 1;
+			break;
+		case BACKEND_OPTION:
+			if (!strcmp(optarg, "io_uring"))
+				option_uring = 1;
+			else if (strcmp(optarg, "poll"))
+				do_usage();
+			break;
+		case THREADS_OPTION:
+			{
+				char *str;
+				long n = strtol(optarg, &str, 10);
+				if (!*optarg || *str || n < 0 || n > 1024)
+					do_usage();
+				opt.threads = n;
+			}
+			break;
+		case STATE_OPTION:
+			if (state_open(optarg) < 0)
+				exit(1);
+			break;
+		case HISTORY_OPTION:
+			{
+				char *str;
+				unsigned long n = strtoul(optarg, &str, 10);
+				if (!*optarg || *str || !n)
+					do_usage();
+				if (history_init(n) < 0) {
+					perror("malloc");
+					exit(1);
+				}
+			}
+			break;
+		case NICE_OPTION:
+			sched_option(&opt.sched, WATCH_SCHED_NICE, optarg);
+			break;
+		case IONICE_OPTION:
+			sched_option(&opt.sched, WATCH_SCHED_IONICE, optarg);
+			break;
+		case SCHED_OPTION:
+			sched_option(&opt.sched, WATCH_SCHED_POLICY, optarg);
+			break;
+		case CPUS_OPTION:
+			sched_option(&opt.sched, WATCH_SCHED_CPUS, optarg);
+			break;
+		case SELF_NICE_OPTION:
+			sched_option(&self_sched, WATCH_SCHED_NICE, optarg);
+			break;
+		case SELF_IONICE_OPTION:
+			sched_option(&self_sched, WATCH_SCHED_IONICE, optarg);
+			break;
+		case SELF_SCHED_OPTION:
+			sched_option(&self_sched, WATCH_SCHED_POLICY, optarg);
+			break;
+		case SELF_CPUS_OPTION:
+			sched_option(&self_sched, WATCH_SCHED_CPUS, optarg);
+			break;
+		case EACH_OPTION:
+			each_option(&opt, optarg);
+			break;
+		case JOBS_OPTION:
+			{
+				char *str;
+				long n = strtol(optarg, &str, 10);
+				if (!*optarg || *str || n < 1 || n > 1024)
+					do_usage();
+				opt.jobs = n;
+			}
+			break;
+		case BASELINE_OPTION:
+			baseline_path = optarg;
+			break;
+		case TAIL_OPTION:
+			opt.tail = 1;
+			break;
+		case TIMELINE_OPTION:
+			opt.timeline = 1;
+			break;
+		case GUARD_OPTION:
+			opt.guard = optarg;
+			break;
+		case GUARD_STAT_OPTION:
+			opt.guard_paths = realloc(opt.guard_paths,
+			    (opt.guard_path_count + 1) * sizeof *opt.guard_paths);
+			if (!opt.guard_paths) {
+				perror("malloc");
+				exit(1);
+			}
+			opt.guard_paths[opt.guard_path_count++] = optarg;
+			break;
+		case BUDGET_OPTION:
+			{
+				char *str;
+				long burst = 1;
+				budget_rate = strtod(optarg, &str);
+				if (*str == ',')
+					burst = strtol(str + 1, &str, 10);
+				if (!*optarg || *str
+				    || !(budget_rate >= WATCH_BUDGET_RATE_MIN)
+				    || budget_rate > WATCH_BUDGET_RATE_MAX
+				    || burst < 1 || burst > WATCH_BUDGET_BURST_MAX)
+					do_usage();
+				budget_burst = burst;
+			}
+			break;
+		case BUDGET_CLASS_OPTION:
+			if (!*optarg || strchr(optarg, '/'))
+				do_usage();
+			budget_class = optarg;
+			break;
+		case BUDGET_STATS_OPTION:
+			budget_stats = 1;
+			break;
+		case GUARD_MAX_AGE_OPTION:
+			{
+				char *str;
+				opt.guard_max_age = strtod(optarg, &str);
+				if (!*optarg || *str || opt.guard_max_age < 0)
+					do_usage();
+			}
+			break;
+		case RECORD_OPTION:
+			if (record_open(optarg) < 0)
+				exit(1);
+			break;
+		case EXPORT_OPTION:
+			export_spec = optarg;
+			break;
+		case ONCE_OPTION:
+			if (!optarg || !strcmp(optarg, "plain"))
+				once_mode = 1;
+			else if (!strcmp(optarg, "ansi"))
+				once_mode = 2;
+			else
+				do_usage();
+			break;
+		case DEBUG_STATS_OPTION:
+			if ((stats_fp = fopen(optarg, "w")) == NULL) {
+				perror(optarg);
+				exit(1);
+			}
+			break;
 		default:
 			do_usage();
 			break;
@@ -343,7 +916,7 @@ main(int argc, char *argv[])
 	}
 
 	if (option_help) {
-		fprintf(stderr, usage, progname);
+		fprintf(stderr, usage, progname, progname, progname, progname, progname);
 		fputs("  -b, --beep\t\t\t\tbeep if the command has a non-zero exit\n", stderr);
 		fputs("  -d, --differences[=cumulative]\thighlight changes between updates\n", stderr);
 		fputs("\t\t(cumulative means highlighting is cumulative)\n", stderr);
@@ -354,9 +927,76 @@ main(int argc, char *argv[])
 		fputs("  -v, --version\t\t\t\tprint the version number\n", stderr);
 		fputs("  -t, --no-title\t\t\tturns off showing the header\n", stderr);
 		fputs("  -x, --exec\t\t\t\tpass command to exec instead of sh\n", stderr);
+		fputs("      --control=<fifo>\t\t\tread commands from a FIFO while running\n", stderr);
+		fputs("      --unfocused=<seconds>|pause\tslow down or pause while the terminal is unfocused\n", stderr);
+		fputs("      --tmux-visibility\t\twith --unfocused, also when the tmux pane is hidden\n", stderr);
+		fputs("      --power-save\t\t\tcoalesce wakeups, slow down while output is unchanged\n", stderr);
+		fputs("      --backend=poll|io_uring\t\twait for events with poll() or io_uring\n", stderr);
+		fputs("      --threads=<n>\t\t\tthreads for very large screens, 0 for one per CPU\n", stderr);
+		fputs("      --state=<file>\t\t\tkeep the last frame and history across restarts\n", stderr);
+		fputs("      --history=<n>\t\t\tkeep the last n outputs for the control FIFO\n", stderr);
+		fputs("      --nice=<n>\t\t\t\tniceness of the command\n", stderr);
+		fputs("      --ionice=<class>[:<level>]\tI/O priority of the command\n", stderr);
+		fputs("      --sched=other|batch|idle\t\tscheduling policy of the command\n", stderr);
+		fputs("      --cpus=<list>\t\t\tCPUs the command may run on\n", stderr);
+		fputs("      --self-nice, --self-ionice, --self-sched, --self-cpus\n", stderr);
+		fputs("\t\t(the same for watch itself)\n", stderr);
+		fputs("      --each=<list>|@<file>\t\trun the command per target, {} replaced by it\n", stderr);
+		fputs("      --jobs=<n>\t\t\t\ttargets run at once with --each, 16 by default\n", stderr);
+		fputs("      --baseline=<file>\t\thighlight what differs from file (or the first output)\n", stderr);
+		fputs("      --tail\t\t\t\tshow the end of the output instead of the start\n", stderr);
+		fputs("      --timeline\t\t\tshow how long the last runs took and how they exited\n", stderr);
+		fputs("      --guard=<command>\t\trun only when the output of command changes\n", stderr);
+		fputs("      --guard-stat=<path>\t\trun only when path changes (may be repeated)\n", stderr);
+		fputs("      --guard-max-age=<seconds>\twith a guard, run at least this often\n", stderr);
+		fputs("      --budget=<rate>[,<burst>]\tshare rate runs a second with every watch on the host\n", stderr);
+		fputs("      --budget-class=<name>\t\tthe budget to share, \"default\" by default\n", stderr);
+		fputs("      --budget-stats\t\t\tprint how runs have waited for the budget and exit\n", stderr);
+		fputs("      --record=<file>\t\t\trecord every frame to file\n", stderr);
+		fputs("      --export=cast|raw[,<timing>]\twrite a recording as an asciinema cast or raw ANSI\n", stderr);
+		fputs("      --once[=plain|ansi]\t\tprint one frame to stdout and exit\n", stderr);
+		fputs("      --debug-stats=<file>\t\twrite per-frame terminal output statistics\n", stderr);
+		fputs("      --simulate=<script>[,<runs>]\treplay scripted outputs on a virtual clock\n", stderr);
+		fputs("      --self-benchmark=spawn[:<n>]\ttime n runs of each way to spawn the command\n", stderr);
+		fputs("      --self-benchmark=soak[:<n>]\trun n times on a virtual clock, fail if memory grows\n", stderr);
 		exit(0);
 	}
 
+	if (self_sched.set) {
+		const char *func;
+		if (watch_sched_apply(&self_sched, &func) < 0) {
+			perror(func);
+			exit(1);
+		}
+	}
+
+	if (export_spec) {
+		if (optind + 1 != argc)
+			do_usage();
+		exit(record_export(export_spec, argv[optind]));
+	}
+
+	if (budget_stats) {
+		const char *func;
+		if (optind != argc)
+			do_usage();
+		if (watch_budget_stats(budget_class, stdout, &func) < 0) {
+			perror(func);
+			exit(1);
+		}
+		exit(0);
+	}
+
+	/* a soak runs watch itself, set up as for real */
+	if (self_benchmark_spec && !strncmp(self_benchmark_spec, "soak", 4)) {
+		if ((soak_ticks = soak_parse(self_benchmark_spec)) == 0)
+			exit(1);
+		self_benchmark_spec = NULL;
+	}
+
+	if (self_benchmark_spec && optind >= argc)
+		exit(self_benchmark(self_benchmark_spec, NULL, NULL, option_exec));
+
 	if (optind >= argc)
 		do_usage();
 
@@ -375,24 +1015,32 @@ main(int argc, char *argv[])
 		command[command_length] = '\0';
 	}
 
-	// convert to wide for printing purposes
-	//mbstowcs(NULL, NULL, 0);
-	wcommand_characters = mbstowcs(NULL, command, 0);
-	if(wcommand_characters < 0) {
-		fprintf(stderr, "Unicode Handling Error\n");
+	if (self_benchmark_spec)
+		exit(self_benchmark(self_benchmark_spec, command, command_argv, option_exec));
+
+	get_terminal_size();
+
+	opt.command = command;
+	opt.argv = command_argv;
+	opt.exec = option_exec;
+	opt.differences = option_differences;
+	opt.cumulative = option_differences_cumulative;
+	opt.color = option_color;
+	if ((w = watch_new(&opt, height, width)) == NULL) {
+		if (errno == EILSEQ)
+			fprintf(stderr, "Unicode Handling Error\n");
+		else
+			fprintf(stderr, "Unicode Handling Error (malloc)\n");
 		exit(1);
 	}
-	wcommand = (wchar_t*)malloc((wcommand_characters+1) * sizeof(wcommand));
-	if(wcommand == NULL) {
-		fprintf(stderr, "Unicode Handling Error (malloc)\n");
+	if (baseline_path && baseline_open(w, baseline_path) < 0)
 		exit(1);
+	if (budget_rate && watch_set_budget(w, budget_class, budget_rate, budget_burst) < 0) {
+		perror(w->errfunc);
+		exit(w->errcode);
 	}
-	mbstowcs(wcommand, command, wcommand_characters+1);
-	wcommand_columns = wcswidth(wcommand, -1);
-
-
-
-	get_terminal_size();
+	if (once_mode)
+		once(w);
 
 	/* Catch keyboard interrupts so we can put tty back in a sane state.  */
 	signal(SIGINT, die);
@@ -400,228 +1048,160 @@ main(int argc, char *argv[])
 	signal(SIGHUP, die);
 	signal(SIGWINCH, winch_handler);
 
+	/* Start the first run now, so that it overlaps setting up curses
+	 * instead of waiting for it, unless it must wait for the budget or
+	 * go after the guard's probe */
+	if (!simulating && !soak_ticks && !budget_rate && !opt.guard
+	    && !opt.guard_path_count) {
+		if (watch_spawn(w) < 0) {
+			perror(w->errfunc);
+			exit(w->errcode);
+		}
+		frame_start = watch_time_usec();
+	}
+
+	/* A simulation or a soak draws into /dev/null; the soak reports
+	 * on stdout as it was, traces go to the stats file */
+	if (simulating || soak_ticks) {
+		struct watch_clock clock = { virtual_clock, NULL };
+		int null_fd = open("/dev/null", O_WRONLY);
+		if (soak_ticks && (soak_out = fdopen(dup(1), "w")) == NULL) {
+			perror("stdout");
+			exit(1);
+		}
+		if (null_fd < 0 || dup2(null_fd, 1) < 0) {
+			perror("/dev/null");
+			exit(1);
+		}
+		close(null_fd);
+		if (simulating && !stats_fp)
+			stats_fp = stderr;
+		if (simulating)
+			watch_set_clock(w, &clock);
+	}
+
 	/* Set up tty for curses use.  */
 	curses_started = 1;
+	if (stats_fp)
+		start_relay();
 	initscr();
-  if (option_color) {
+  /* the timeline is in color even without --color */
+  if (option_color || opt.timeline) {
     if (has_colors()) {
       start_color();
       use_default_colors();
       init_ansi_colors();
+      draw_colors = 1;
     } else
       option_color = 0;
   }
 	nonl();
 	noecho();
 	cbreak();
+	idlok(stdscr, TRUE);	/* scroll output that scrolls (see render.c) */
+	if (focus_reporting) {
+		putp("\033[?1004h");
+		fflush(stdout);
+	}
+	if (tmux_visibility && opt.unfocused_interval < 0)
+		tmux_visibility = 0;	/* nothing to do when hidden */
+	read_keys = isatty(0);	/* focus reports come from the terminal too */
 
-	if (precise_timekeeping)
-		next_loop = get_time_usec();
+	sink.draw = render_sink;
+	sink.arg = &draw_colors;
+	watch_set_sink(w, &sink);
+	state_restore(w);
+
+	if (simulating)
+		simulate(w);
+	if (option_uring)
+		uring = uring_open();	/* else poll() it is */
+	render_threaded = render_start(stats_fp ? stats_drawn : NULL) == 0;
+	if (soak_ticks)
+		do_exit(soak(w, soak_ticks, soak_out, soak_frame));
 
 	for (;;) {
-		time_t t = time(NULL);
-		char *ts = ctime(&t);
-		int tsl = strlen(ts);
-		char *header;
-		FILE *p;
-		int x, y;
-		int oldeolseen = 1;
+		struct pollfd pfd[3];
+		long long timeout;
+		int nfds = 0, events;
 
 		if (screen_size_changed) {
-			get_terminal_size();
-			resizeterm(height, width);
-			clear();
-			/* redrawwin(stdscr); */
 			screen_size_changed = 0;
-			first_screen = 1;
-		}
-
-		if (show_title) {
-			// left justify interval and command,
-			// right justify time, clipping all to fit window width
-
-			int hlen = asprintf(&header, "Every %.1fs: ", interval);
-
-			// the rules:
-			//   width < tsl : print nothing
-			//   width < tsl + hlen + 1: print ts
-			//   width = tsl + hlen + 1: print header, ts
-			//   width < tsl + hlen + 4: print header, ..., ts
-			//   width < tsl + hlen + wcommand_columns: print header, truncated wcommand, ..., ts
-			//   width > "": print header, wcomand, ts
-			// this is slightly different from how it used to be
-			if(width >= tsl) {
-				if(width >= tsl + hlen + 1) {
-					mvaddstr(0, 0, header);
-					if(width >= tsl + hlen + 2) {
-						if(width < tsl + hlen + 4) {
-							mvaddstr(0, width - tsl - 4, "...  ");
-						}else{
-							if(width < tsl + hlen + wcommand_columns) {
-								// print truncated
-								int avail_columns = width - tsl - hlen;
-								int using_columns = wcommand_columns;
-								int using_characters = wcommand_characters;
-								while(using_columns > avail_columns - 4) {
-									using_characters--;
-								using_columns = wcswidth(wcommand, using_characters);
-								}
-								mvaddnwstr(0, hlen, wcommand, using_characters);
-								mvaddstr(0, width - tsl - 4, "... ");
-							}else{
-								mvaddwstr(0, hlen, wcommand);
-							}
-						}
-					}
-				}
-				mvaddstr(0, width - tsl + 1, ts);
+			get_terminal_size();
+			if (watch_resize(w, height, width) < 0) {
+				perror(w->errfunc);
+				do_exit(w->errcode);
 			}
-
-			free(header);
 		}
 
-		/* allocate pipes */
-		if (pipe(pipefd)<0) {
-		  perror("pipe");
-			do_exit(7);
-	  }
-
-		/* flush stdout and stderr, since we're about to do fd stuff */
-		fflush(stdout);
-		fflush(stderr);
-
-		/* fork to prepare to run command */
-		child=fork();
-
-		if (child<0) { /* fork error */
-		  perror("fork");
-			do_exit(2);
-		} else if (child==0) { /* in child */
-			close (pipefd[0]); /* child doesn't need read side of pipe */
-			close (1); /* prepare to replace stdout with pipe */
-			if (dup2 (pipefd[1], 1)<0) { /* replace stdout with write side of pipe */
-			  perror("dup2");
-				exit(3);
-			}
-			dup2(1, 2); /* stderr should default to stdout */
-
-			if (option_exec) { /* pass command to exec instead of system */
-			  if (execvp(command_argv[0], command_argv)==-1) {
-				  perror("exec");
-				  exit(4);
-				}
-			} else {
-		    status=system(command); /* watch manpage promises sh quoting */
-
-			  /* propagate command exit status as child exit status */
-			  if (!WIFEXITED(status)) { /* child exits nonzero if command does */
-			    exit(1);
-			  } else {
-			    exit(WEXITSTATUS(status));
-		    }
-			}
-
+		/* before a run is due while shown, once an interval while hidden */
+		if (tmux_visibility && w->state == WATCH_IDLE && !w->paused
+		    && (!tmux_visible || watch_timeout(w) == 0)
+		    && watch_time_usec() >= tmux_check_at) {
+			tmux_visible = tmux_pane_visible();
+			tmux_check_at = watch_time_usec() + (tmux_visible
+			    ? TMUX_CHECK_USEC : USECS_PER_SEC*w->opt.interval);
+			watch_set_focus(w, terminal_focused && tmux_visible);
 		}
 
-		/* otherwise, we're in parent */
-		close(pipefd[1]); /* close write side of pipe */
-		if ((p=fdopen(pipefd[0], "r"))==NULL) {
-		  perror("fdopen");
-			do_exit(5);
+		/* io_uring waits for the child to exit itself */
+		timeout = uring && w->state == WATCH_REAPING ? -1 : watch_timeout(w);
+		if (tmux_visibility && !tmux_visible) {
+			watch_usec_t now = watch_time_usec();
+			long long until = tmux_check_at > now ? (long long) (tmux_check_at - now) : 0;
+			if (timeout < 0 || until < timeout)
+				timeout = until;
 		}
-
-
-		for (y = show_title; y < height; y++) {
-			int eolseen = 0, tabpending = 0;
-			wint_t carry = WEOF;
-			for (x = 0; x < width; x++) {
-				wint_t c = L' ';
-				int attr = 0;
-
-				if (!eolseen) {
-					/* if there is a tab pending, just spit spaces until the
-					   next stop instead of reading characters */
-					if (!tabpending)
-						do {
-							if(carry == WEOF) {
-								c = my_getwc(p);
-							}else{
-								c = carry;
-								carry = WEOF;
-							}
-						}while (c != WEOF && !isprint(c) && c<128
-						       && wcwidth(c) == 0
-						       && c != L'\n'
-						       && c != L'\t'
-                   && (c != L'\033' || option_color != 1));
-          if (c == L'\033' && option_color == 1) {
-            x--;
-            process_ansi(p);
-            continue;
-          }
-					if (c == L'\n')
-						if (!oldeolseen && x == 0) {
-							x = -1;
-							continue;
-						} else
-							eolseen = 1;
-					else if (c == L'\t')
-						tabpending = 1;
-					if (x==width-1 && wcwidth(c)==2) {
-						y++;
-						x = -1; //process this double-width
-						carry = c; //character on the next line
-						continue; //because it won't fit here
-					}
-					if (c == WEOF || c == L'\n' || c == L'\t')
-						c = L' ';
-					if (tabpending && (((x + 1) % 8) == 0))
-						tabpending = 0;
-				}
-				move(y, x);
-				if (option_differences) {
-						cchar_t oldc;
-					in_wch(&oldc);
-					attr = !first_screen
-					    && ((wchar_t)c != oldc.chars[0]
-						||
-						(option_differences_cumulative
-						 && (oldc.attr & A_ATTRIBUTES)));
-				}
-				if (attr)
-					standout();
-				addnwstr((wchar_t*)&c,1);
-				if (attr)
-					standend();
-				if(wcwidth(c) == 0) { x--; }
-				if(wcwidth(c) == 2) { x++; }
+		if (render_pending() && (timeout < 0 || timeout > RENDER_RETRY_USEC))
+			timeout = RENDER_RETRY_USEC;
+		if (read_keys) {
+			pfd[nfds].fd = 0;
+			pfd[nfds].revents = 0;
+			pfd[nfds++].events = POLLIN;
+		}
+		/* io_uring reads the child's output itself, not the probe's */
+		if (watch_fd(w) >= 0 && (!uring || w->state == WATCH_PROBING)) {
+			pfd[nfds].fd = watch_fd(w);
+			pfd[nfds++].events = POLLIN;
+		}
+		if (control_fd >= 0) {
+			pfd[nfds].fd = control_fd;
+			pfd[nfds++].events = POLLIN;
+		}
+		if (stats_fp && timeout != 0)
+			stats_wakeup(watch_time_usec());
+		events = 0;
+		if (uring) {
+			if ((events = uring_wait(uring, w, pfd, nfds, timeout)) < 0) {
+				perror(w->errfunc);
+				do_exit(w->errcode);
 			}
-			oldeolseen = eolseen;
+		} else if (timeout != 0
+		    && poll(pfd, nfds, timeout < 0 ? -1 : (int) ((timeout + 999) / 1000)) < 0
+		    && errno != EINTR) {
+			perror("poll");
+			do_exit(1);
 		}
+		if (render_pending())
+			render_retry(w);
+		if (control_fd >= 0)
+			control_read(w, control_fd);
+		if (read_keys && nfds && pfd[0].fd == 0 && (pfd[0].revents & POLLIN))
+			read_input(w);
 
-		fclose(p);
-
-		/* harvest child process and get status, propagated from command */
-		if (waitpid(child, &status, 0)<0) {
-		  perror("waitpid");
-			do_exit(8);
-		};
-
-		/* if child process exited in error, beep if option_beep is set */
-		if ((!WIFEXITED(status) || WEXITSTATUS(status))) {
-          if (option_beep) beep();
-          if (option_errexit) do_exit(8);
+		/* with io_uring only starting runs is left to watch_step() */
+		if (!uring || w->state == WATCH_IDLE || w->state == WATCH_PROBING) {
+			int r = watch_step(w);
+			if (r < 0) {
+				perror(w->errfunc);
+				do_exit(w->errcode);
+			}
+			events |= r;
 		}
-
-		first_screen = 0;
-		refresh();
-		if (precise_timekeeping) {
-			watch_usec_t cur_time = get_time_usec();
-			next_loop += USECS_PER_SEC*interval;
-			if (cur_time < next_loop)
-				usleep(next_loop - cur_time);
-		} else
-		usleep(interval * 1000000);
+		if (events & WATCH_STARTED)
+			frame_start = watch_time_usec();
+		if (events & WATCH_FRAME)
+			run_finished(w, frame_start);
 	}
 
 	endwin();